@@ -0,0 +1,53 @@
+#pragma once
+
+#include "rtweekend.h"
+#include "ray.h"
+
+#include <utility>
+
+class aabb {
+public:
+    // An empty box, ready to be grown with surrounding_box.
+    aabb() : _min(infinity, infinity, infinity), _max(-infinity, -infinity, -infinity) {}
+    aabb(const point3& a, const point3& b) : _min(a), _max(b) {}
+
+    point3 min() const { return _min; }
+    point3 max() const { return _max; }
+
+    point3 centroid() const {
+        return 0.5 * (_min + _max);
+    }
+
+    real surface_area() const {
+        auto d = _max - _min;
+        if (d.x() < 0 || d.y() < 0 || d.z() < 0) return 0;
+        return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    bool hit(const ray& r, real tmin, real tmax) const {
+        for (int a = 0; a < 3; ++a) {
+            auto inv_d = 1 / r.dir[a];
+            auto t0 = (_min[a] - r.orig[a]) * inv_d;
+            auto t1 = (_max[a] - r.orig[a]) * inv_d;
+            if (inv_d < 0) std::swap(t0, t1);
+            tmin = t0 > tmin ? t0 : tmin;
+            tmax = t1 < tmax ? t1 : tmax;
+            if (tmax <= tmin) return false;
+        }
+        return true;
+    }
+
+public:
+    point3 _min;
+    point3 _max;
+};
+
+inline aabb surrounding_box(const aabb& box0, const aabb& box1) {
+    point3 small(fmin(box0._min.x(), box1._min.x()),
+                 fmin(box0._min.y(), box1._min.y()),
+                 fmin(box0._min.z(), box1._min.z()));
+    point3 big(fmax(box0._max.x(), box1._max.x()),
+               fmax(box0._max.y(), box1._max.y()),
+               fmax(box0._max.z(), box1._max.z()));
+    return aabb(small, big);
+}
@@ -0,0 +1,105 @@
+// Benchmark of the acceleration structures on fields of 500, 50k and 1M
+// small spheres over a ground sphere: build time, then closest-hit rays per
+// second for the same camera rays through the binary bvh, bvh4 and bvh8,
+// against the plain hittable_list and the pointer-linked bvh_node.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "rtweekend.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "bvh.h"
+#include "wide_bvh.h"
+
+namespace {
+
+const int image_side = 256;         // camera rays per side
+const double time_budget = 2.0;     // seconds of tracing per structure at most
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// A square of count spheres of radius 0.2, a unit apart with some jitter,
+// lying on a ground sphere.
+hittable_list sphere_field(size_t count) {
+    hittable_list world;
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, 0));
+    auto side = static_cast<size_t>(std::ceil(std::sqrt(double(count))));
+    for (size_t k = 0; k < count; ++k) {
+        auto a = real(k % side) - real(side) / 2, b = real(k / side) - real(side) / 2;
+        world.add(make_shared<sphere>(point3(a + 0.6 * random_double(), 0.2, b + 0.6 * random_double()), 0.2, 0));
+    }
+    return world;
+}
+
+// Camera rays looking down across the field from above one corner.
+std::vector<ray> camera_rays(size_t count) {
+    auto half = real(std::sqrt(double(count))) / 2;
+    point3 eye(-half, 0.3 * half + 2, -half);
+    vec3 forward = unit_vector(point3(0, 0, 0) - eye);
+    vec3 right = unit_vector(cross(forward, vec3(0, 1, 0)));
+    vec3 up = cross(right, forward);
+    std::vector<ray> rays;
+    for (int j = 0; j < image_side; ++j) {
+        for (int i = 0; i < image_side; ++i) {
+            auto u = (i + 0.5) / image_side - 0.5, v = (j + 0.5) / image_side - 0.5;
+            rays.push_back(ray(eye, forward + 0.8 * u * right + 0.8 * v * up));
+        }
+    }
+    return rays;
+}
+
+// Traces rays with hit() until they run out or the time budget is spent,
+// and prints the rate. The rays are taken in an order that strides across
+// the image, so the slow list still samples all of it within its budget.
+// The hit rate makes the structures comparable.
+void trace(const char* name, const hittable& world, const std::vector<ray>& rays, double build_seconds) {
+    const size_t stride = 40503;    // odd, so every ray comes up once
+    auto start = std::chrono::steady_clock::now();
+    size_t traced = 0, hits = 0;
+    hit_record rec;
+    for (size_t k = 0; k < rays.size(); ++k) {
+        hits += world.hit(rays[k * stride % rays.size()], epsilon, infinity, rec);
+        // Check the clock now and then only.
+        if (++traced % 64 == 0 && seconds_since(start) > time_budget)
+            break;
+    }
+    auto seconds = seconds_since(start);
+    printf("  %-6s %10.3g rays/s  build %6.2f s  %zu of %zu rays traced, %.1f%% hit\n",
+        name, traced / seconds, build_seconds, traced, rays.size(), 100.0 * hits / traced);
+}
+
+}
+
+int main()
+{
+    for (size_t count : { size_t(500), size_t(50000), size_t(1000000) }) {
+        thread_rng() = pcg32();
+        auto world = sphere_field(count);
+        auto rays = camera_rays(count);
+        printf("%zu spheres\n", count);
+
+        trace("list", world, rays, 0);
+
+        auto start = std::chrono::steady_clock::now();
+        bvh_node node_tree(world);
+        trace("node", node_tree, rays, seconds_since(start));
+
+        start = std::chrono::steady_clock::now();
+        bvh tree(world, bvh_build::sah);
+        trace("bvh", tree, rays, seconds_since(start));
+
+        start = std::chrono::steady_clock::now();
+        bvh4 tree4(world, bvh_build::sah);
+        trace("bvh4", tree4, rays, seconds_since(start));
+
+        start = std::chrono::steady_clock::now();
+        bvh8 tree8(world, bvh_build::sah);
+        trace("bvh8", tree8, rays, seconds_since(start));
+    }
+    return 0;
+}
@@ -0,0 +1,541 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+
+#include <omp.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+const int sah_bins = 16;
+
+// Past this depth splits fall back to the median, which keeps every tree
+// shallow enough for the fixed traversal stack of linear_bvh.
+const int max_sah_depth = 32;
+
+struct sah_bin {
+    aabb bounds;
+    size_t count = 0;
+};
+
+aabb object_box(const shared_ptr<hittable>& object) {
+    aabb box;
+    if (!object->bounding_box(box))
+        std::cerr << "No bounding box in bvh_node constructor.\n";
+    return box;
+}
+
+// Partitions [first, last) around the cheapest binned SAH plane on the axis
+// where the centroids spread the most, or around the median when no plane
+// separates them. split_cost receives the unnormalized SAH cost of the split.
+template <typename It, typename BoxOf>
+It sah_partition(It first, It last, BoxOf box_of, double& split_cost, int& split_axis, bool median = false) {
+    size_t span = last - first;
+
+    aabb centroid_bounds;
+    for (auto it = first; it != last; ++it) {
+        auto c = box_of(*it).centroid();
+        centroid_bounds = surrounding_box(centroid_bounds, aabb(c, c));
+    }
+    auto extent = centroid_bounds.max() - centroid_bounds.min();
+    int axis = 0;
+    if (extent[1] > extent[axis]) axis = 1;
+    if (extent[2] > extent[axis]) axis = 2;
+    split_axis = axis;
+    split_cost = infinity;
+
+    if (!median && extent[axis] > 0) {
+        auto axis_min = centroid_bounds.min()[axis];
+        auto scale = sah_bins / extent[axis];
+        auto bin_of = [&](const auto& item) {
+            int b = static_cast<int>((box_of(item).centroid()[axis] - axis_min) * scale);
+            return b < sah_bins ? b : sah_bins - 1;
+        };
+
+        sah_bin bins[sah_bins];
+        for (auto it = first; it != last; ++it) {
+            auto& bin = bins[bin_of(*it)];
+            bin.bounds = surrounding_box(bin.bounds, box_of(*it));
+            ++bin.count;
+        }
+
+        // Sweep from the right to collect the cost of every right-hand side,
+        // then from the left to find the cheapest split plane.
+        double right_cost[sah_bins];
+        aabb right_box;
+        size_t right_count = 0;
+        for (int b = sah_bins - 1; b > 0; --b) {
+            right_box = surrounding_box(right_box, bins[b].bounds);
+            right_count += bins[b].count;
+            right_cost[b] = right_count * right_box.surface_area();
+        }
+
+        int best_split = 0;
+        aabb left_box;
+        size_t left_count = 0;
+        for (int b = 1; b < sah_bins; ++b) {
+            left_box = surrounding_box(left_box, bins[b - 1].bounds);
+            left_count += bins[b - 1].count;
+            auto cost = left_count * left_box.surface_area() + right_cost[b];
+            if (left_count > 0 && left_count < span && cost < split_cost) {
+                split_cost = cost;
+                best_split = b;
+            }
+        }
+
+        if (best_split > 0)
+            return std::partition(first, last, [&](const auto& item) {
+                return bin_of(item) < best_split;
+            });
+    }
+
+    // No plane separates the bins: fall back to a median split.
+    auto mid = first + span / 2;
+    std::nth_element(first, mid, last, [&](const auto& a, const auto& b) {
+        return box_of(a).centroid()[axis] < box_of(b).centroid()[axis];
+    });
+    return mid;
+}
+
+// Rounds outwards so the float node bounds always contain the double box.
+float round_down(double x) {
+    auto f = static_cast<float>(x);
+    return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+float round_up(double x) {
+    auto f = static_cast<float>(x);
+    return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+struct linear_builder {
+    const std::vector<aabb>& boxes;
+    std::vector<uint32_t>& order;
+    std::vector<linear_bvh_node>& nodes;
+
+    void build(size_t start, size_t end, int depth) {
+        auto index = nodes.size();
+        nodes.emplace_back();
+
+        aabb box;
+        for (size_t i = start; i < end; ++i)
+            box = surrounding_box(box, boxes[order[i]]);
+        for (int a = 0; a < 3; ++a) {
+            nodes[index].bounds_min[a] = round_down(box.min()[a]);
+            nodes[index].bounds_max[a] = round_up(box.max()[a]);
+        }
+
+        size_t span = end - start;
+        if (span > 1) {
+            double split_cost;
+            int axis;
+            auto mid = sah_partition(order.begin() + start, order.begin() + end,
+                [this](uint32_t i) -> const aabb& { return boxes[i]; },
+                split_cost, axis, depth >= max_sah_depth) - order.begin();
+
+            // Traversing a node costs about as much as one primitive test.
+            auto leaf_cost = span * box.surface_area();
+            if (span > linear_bvh::max_leaf_size || split_cost + box.surface_area() < leaf_cost) {
+                nodes[index].count = 0;
+                nodes[index].axis = static_cast<uint16_t>(axis);
+                build(start, mid, depth + 1);
+                nodes[index].offset = static_cast<uint32_t>(nodes.size());
+                build(mid, end, depth + 1);
+                return;
+            }
+        }
+
+        nodes[index].offset = static_cast<uint32_t>(start);
+        nodes[index].count = static_cast<uint16_t>(span);
+        nodes[index].axis = 0;
+    }
+};
+
+int count_leading_zeros(uint32_t x) {
+    if (x == 0) return 32;
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, x);
+    return 31 - static_cast<int>(index);
+#else
+    return __builtin_clz(x);
+#endif
+}
+
+// Spreads the low 10 bits of v so that there are two zero bits between each.
+uint32_t expand_bits(uint32_t v) {
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// 30-bit Morton code of a point in the unit cube, x in the highest bit of each triple.
+uint32_t morton3(double x, double y, double z) {
+    auto quantize = [](double v) {
+        return static_cast<uint32_t>(clamp(v * 1024, 0, 1023));
+    };
+    return (expand_bits(quantize(x)) << 2) | (expand_bits(quantize(y)) << 1) | expand_bits(quantize(z));
+}
+
+// Stable LSD radix sort of (key, value) pairs by the low 30 bits of key.
+// Every pass histograms per thread, then scatters each thread's chunk to its
+// own precomputed offsets.
+void parallel_radix_sort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values) {
+    const int radix_bits = 8;
+    const int radix = 1 << radix_bits;
+    auto n = static_cast<int64_t>(keys.size());
+    std::vector<uint32_t> keys_tmp(n), values_tmp(n);
+    std::vector<int64_t> offsets;
+
+    for (int shift = 0; shift < 30; shift += radix_bits) {
+        #pragma omp parallel
+        {
+            int nthreads = omp_get_num_threads();
+            int tid = omp_get_thread_num();
+            int64_t begin = n * tid / nthreads;
+            int64_t end = n * (tid + 1) / nthreads;
+
+            #pragma omp single
+            offsets.assign(static_cast<size_t>(nthreads) * radix, 0);
+
+            auto local = &offsets[static_cast<size_t>(tid) * radix];
+            for (auto i = begin; i < end; ++i)
+                ++local[(keys[i] >> shift) & (radix - 1)];
+
+            #pragma omp barrier
+            #pragma omp single
+            {
+                int64_t sum = 0;
+                for (int digit = 0; digit < radix; ++digit) {
+                    for (int t = 0; t < nthreads; ++t) {
+                        auto count = offsets[static_cast<size_t>(t) * radix + digit];
+                        offsets[static_cast<size_t>(t) * radix + digit] = sum;
+                        sum += count;
+                    }
+                }
+            }
+
+            for (auto i = begin; i < end; ++i) {
+                auto dst = local[(keys[i] >> shift) & (radix - 1)]++;
+                keys_tmp[dst] = keys[i];
+                values_tmp[dst] = values[i];
+            }
+        }
+        keys.swap(keys_tmp);
+        values.swap(values_tmp);
+    }
+}
+
+// Linear BVH after Karras, "Maximizing Parallelism in the Construction of
+// BVHs, Octrees, and k-d Trees" (2012). Internal node i of the radix tree has
+// id i, leaf k has id (n - 1) + k; every stage runs in parallel.
+struct lbvh_builder {
+    lbvh_builder(const std::vector<aabb>& boxes, std::vector<uint32_t>& order, std::vector<linear_bvh_node>& nodes)
+        : boxes(boxes), order(order), nodes(nodes) {}
+
+    const std::vector<aabb>& boxes;
+    std::vector<uint32_t>& order;
+    std::vector<linear_bvh_node>& nodes;
+
+    int64_t n = 0;
+    std::vector<uint32_t> codes;
+    std::vector<uint32_t> left, right, parent;
+    std::vector<uint32_t> first, count;     // primitive range below each node
+    std::vector<uint32_t> size;             // emitted flat nodes below each node
+    std::vector<linear_bvh_node> tree;      // bounds and axis per node id
+
+    bool is_leaf(uint32_t id) const { return id >= n - 1; }
+
+    // Length of the common prefix of the keys at i and j, ties broken by index.
+    int delta(int64_t i, int64_t j) const {
+        if (j < 0 || j >= n) return -1;
+        if (codes[i] == codes[j])
+            return 32 + count_leading_zeros(static_cast<uint32_t>(i ^ j));
+        return count_leading_zeros(codes[i] ^ codes[j]);
+    }
+
+    void build() {
+        n = static_cast<int64_t>(boxes.size());
+        compute_codes();
+        parallel_radix_sort(codes, order);
+
+        auto ids = 2 * n - 1;
+        left.resize(ids);
+        right.resize(ids);
+        parent.resize(ids);
+        first.resize(ids);
+        count.resize(ids);
+        size.resize(ids);
+        tree.resize(ids);
+        parent[0] = 0;
+
+        build_radix_tree();
+        compute_bounds();
+
+        nodes.resize(size[0]);
+        #pragma omp parallel
+        #pragma omp single
+        emit(0, 0);
+    }
+
+    void compute_codes() {
+        aabb centroid_bounds;
+        #pragma omp parallel
+        {
+            aabb local;
+            #pragma omp for nowait
+            for (int64_t i = 0; i < n; ++i) {
+                auto c = boxes[i].centroid();
+                local = surrounding_box(local, aabb(c, c));
+            }
+            #pragma omp critical
+            centroid_bounds = surrounding_box(centroid_bounds, local);
+        }
+
+        auto lo = centroid_bounds.min();
+        auto extent = centroid_bounds.max() - lo;
+        vec3 scale(extent.x() > 0 ? 1 / extent.x() : 0,
+                   extent.y() > 0 ? 1 / extent.y() : 0,
+                   extent.z() > 0 ? 1 / extent.z() : 0);
+
+        codes.resize(n);
+        #pragma omp parallel for
+        for (int64_t i = 0; i < n; ++i) {
+            auto c = (boxes[i].centroid() - lo) * scale;
+            codes[i] = morton3(c.x(), c.y(), c.z());
+        }
+    }
+
+    void build_radix_tree() {
+        #pragma omp parallel for
+        for (int64_t i = 0; i < n - 1; ++i) {
+            // Direction of the range covered by node i and its far end.
+            int d = delta(i, i + 1) > delta(i, i - 1) ? 1 : -1;
+            int delta_min = delta(i, i - d);
+            int64_t l_max = 2;
+            while (delta(i, i + l_max * d) > delta_min)
+                l_max *= 2;
+            int64_t l = 0;
+            for (auto t = l_max / 2; t >= 1; t /= 2) {
+                if (delta(i, i + (l + t) * d) > delta_min)
+                    l += t;
+            }
+            int64_t j = i + l * d;
+
+            // Binary search for the split position.
+            int delta_node = delta(i, j);
+            int64_t s = 0;
+            int64_t t = l;
+            do {
+                t = (t + 1) / 2;
+                if (delta(i, i + (s + t) * d) > delta_node)
+                    s += t;
+            } while (t > 1);
+            int64_t gamma = i + s * d + (d < 0 ? -1 : 0);
+
+            auto lo = i < j ? i : j;
+            auto hi = i < j ? j : i;
+            auto left_id = static_cast<uint32_t>(lo == gamma ? (n - 1) + gamma : gamma);
+            auto right_id = static_cast<uint32_t>(hi == gamma + 1 ? (n - 1) + gamma + 1 : gamma + 1);
+            left[i] = left_id;
+            right[i] = right_id;
+            parent[left_id] = static_cast<uint32_t>(i);
+            parent[right_id] = static_cast<uint32_t>(i);
+            first[i] = static_cast<uint32_t>(lo);
+            count[i] = static_cast<uint32_t>(hi - lo + 1);
+
+            // Children differ first in the highest bit where the range's end codes differ.
+            auto diff = codes[lo] ^ codes[hi];
+            tree[i].axis = static_cast<uint16_t>(diff ? 2 - (31 - count_leading_zeros(diff)) % 3 : 0);
+        }
+    }
+
+    // Walks up from every leaf; the second thread to reach a node merges its
+    // children, so each node is finished exactly once without locks.
+    void compute_bounds() {
+        std::unique_ptr<std::atomic<int>[]> visits(new std::atomic<int>[n - 1]);
+        #pragma omp parallel for
+        for (int64_t i = 0; i < n - 1; ++i)
+            visits[i].store(0, std::memory_order_relaxed);
+
+        #pragma omp parallel for
+        for (int64_t k = 0; k < n; ++k) {
+            auto id = static_cast<uint32_t>((n - 1) + k);
+            const auto& box = boxes[order[k]];
+            for (int a = 0; a < 3; ++a) {
+                tree[id].bounds_min[a] = round_down(box.min()[a]);
+                tree[id].bounds_max[a] = round_up(box.max()[a]);
+            }
+            first[id] = static_cast<uint32_t>(k);
+            count[id] = 1;
+            size[id] = 1;
+
+            while (id != 0) {
+                id = parent[id];
+                if (visits[id].fetch_add(1, std::memory_order_acq_rel) == 0)
+                    break;
+
+                const auto& l = tree[left[id]];
+                const auto& r = tree[right[id]];
+                for (int a = 0; a < 3; ++a) {
+                    tree[id].bounds_min[a] = std::min(l.bounds_min[a], r.bounds_min[a]);
+                    tree[id].bounds_max[a] = std::max(l.bounds_max[a], r.bounds_max[a]);
+                }
+                // Small subtrees collapse into a single leaf over their primitive range.
+                size[id] = count[id] <= linear_bvh::max_leaf_size ? 1 : 1 + size[left[id]] + size[right[id]];
+            }
+        }
+    }
+
+    void emit(uint32_t id, uint32_t pos) {
+        auto& node = nodes[pos];
+        node = tree[id];
+        if (is_leaf(id) || count[id] <= linear_bvh::max_leaf_size) {
+            node.offset = first[id];
+            node.count = static_cast<uint16_t>(count[id]);
+            node.axis = 0;
+            return;
+        }
+
+        auto right_pos = pos + 1 + size[left[id]];
+        node.offset = right_pos;
+        node.count = 0;
+
+        if (size[id] > 4096) {
+            #pragma omp task
+            emit(left[id], pos + 1);
+            emit(right[id], right_pos);
+            #pragma omp taskwait
+        } else {
+            emit(left[id], pos + 1);
+            emit(right[id], right_pos);
+        }
+    }
+};
+
+} // namespace
+
+bvh_node::bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
+    size_t object_span = end - start;
+
+    if (object_span == 1) {
+        left = right = objects[start];
+        box = object_box(left);
+        return;
+    }
+    if (object_span == 2) {
+        left = objects[start];
+        right = objects[start + 1];
+        box = surrounding_box(object_box(left), object_box(right));
+        return;
+    }
+
+    double split_cost;
+    int axis;
+    auto mid = sah_partition(objects.begin() + start, objects.begin() + end, object_box, split_cost, axis) - objects.begin();
+
+    left = make_shared<bvh_node>(objects, start, mid);
+    right = make_shared<bvh_node>(objects, mid, end);
+    box = surrounding_box(object_box(left), object_box(right));
+}
+
+bool bvh_node::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    if (!box.hit(r, t_min, t_max))
+        return false;
+
+    bool hit_left = left->hit(r, t_min, t_max, rec);
+    if (right == left)
+        return hit_left;
+    bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+
+    return hit_left || hit_right;
+}
+
+bool bvh_node::occluded(const ray& r, real t_min, real t_max) const {
+    if (!box.hit(r, t_min, t_max))
+        return false;
+    return left->occluded(r, t_min, t_max) || (right != left && right->occluded(r, t_min, t_max));
+}
+
+bool bvh_node::bounding_box(aabb& output_box) const {
+    output_box = box;
+    return true;
+}
+
+linear_bvh::linear_bvh(const std::vector<aabb>& boxes, std::vector<uint32_t>& order, bvh_build method) {
+    order.resize(boxes.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = static_cast<uint32_t>(i);
+
+    if (boxes.empty())
+        return;
+
+    if (method == bvh_build::lbvh && boxes.size() > 1) {
+        lbvh_builder(boxes, order, nodes).build();
+        return;
+    }
+
+    nodes.reserve(2 * boxes.size() - 1);
+    linear_builder{ boxes, order, nodes }.build(0, boxes.size(), 0);
+}
+
+aabb linear_bvh::bounds() const {
+    if (nodes.empty())
+        return aabb();
+    const auto& root = nodes[0];
+    return aabb(
+        point3(root.bounds_min[0], root.bounds_min[1], root.bounds_min[2]),
+        point3(root.bounds_max[0], root.bounds_max[1], root.bounds_max[2]));
+}
+
+bvh::bvh(const hittable_list& list, bvh_build method) {
+    auto n = static_cast<int64_t>(list.objects.size());
+    std::vector<aabb> boxes(n);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < n; ++i)
+        boxes[i] = object_box(list.objects[i]);
+
+    std::vector<uint32_t> order;
+    tree = linear_bvh(boxes, order, method);
+
+    objects.resize(n);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < n; ++i)
+        objects[i] = list.objects[order[i]];
+}
+
+bool bvh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    return tree.traverse(r, t_min, t_max, [&](uint32_t first, uint32_t count, real& closest) {
+        bool hit_anything = false;
+        for (auto i = first; i < first + count; ++i) {
+            if (objects[i]->hit(r, t_min, closest, rec)) {
+                hit_anything = true;
+                closest = rec.t;
+            }
+        }
+        return hit_anything;
+    });
+}
+
+bool bvh::occluded(const ray& r, real t_min, real t_max) const {
+    return tree.occluded(r, t_min, t_max, [&](uint32_t first, uint32_t count) {
+        for (auto i = first; i < first + count; ++i) {
+            if (objects[i]->occluded(r, t_min, t_max))
+                return true;
+        }
+        return false;
+    });
+}
+
+bool bvh::bounding_box(aabb& output_box) const {
+    output_box = tree.bounds();
+    return !tree.nodes.empty();
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <cstdint>
+#include <vector>
+
+// Bounding volume hierarchy built top-down with a binned surface area
+// heuristic, one heap node per split linked by pointers. Nothing renders with
+// it any more; accel_bench keeps it as the baseline the flattened bvh below
+// is measured against.
+class bvh_node : public hittable {
+public:
+    bvh_node() {}
+    bvh_node(const hittable_list& list) : bvh_node(std::vector<shared_ptr<hittable>>(list.objects)) {}
+    bvh_node(std::vector<shared_ptr<hittable>> objects) : bvh_node(objects, 0, objects.size()) {}
+    bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end);
+
+    virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+    virtual bool bounding_box(aabb& output_box) const;
+    virtual bool occluded(const ray& r, real tmin, real tmax) const;
+
+public:
+    shared_ptr<hittable> left;
+    shared_ptr<hittable> right;
+    aabb box;
+};
+
+// Compact BVH node. Nodes are stored depth-first, so the first child of an
+// interior node is the node right after it and only the second one is linked.
+struct alignas(32) linear_bvh_node {
+    float bounds_min[3];
+    float bounds_max[3];
+    uint32_t offset;    // leaf: first primitive, interior: second child
+    uint16_t count;     // number of primitives, 0 for interior nodes
+    uint16_t axis;      // split axis, used to order the children front to back
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must fit in 32 bytes");
+
+enum class bvh_build {
+    sah,    // serial top-down binned SAH, best trees
+    lbvh    // parallel Morton code (LBVH) build, fastest rebuilds
+};
+
+// Primitive-agnostic flattened hierarchy: it only sees primitive bounds and
+// hands leaf ranges of the build order back to the caller during traversal.
+class linear_bvh {
+public:
+    static const int max_leaf_size = 4;
+    static const int stack_size = 64;
+
+    linear_bvh() {}
+    // Builds over the given boxes; order receives the primitive indices in leaf order.
+    linear_bvh(const std::vector<aabb>& boxes, std::vector<uint32_t>& order, bvh_build method = bvh_build::sah);
+
+    aabb bounds() const;
+
+    // Visits the leaves hit by r, nearest first. leaf_hit(first, count, t_max)
+    // tests the primitives [first, first + count) of the build order, shrinks
+    // t_max to the closest hit and returns whether it found one.
+    template <typename LeafHit>
+    bool traverse(const ray& r, real t_min, real t_max, LeafHit&& leaf_hit) const;
+
+    // Visits the leaves hit by r until leaf_occluded(first, count) reports
+    // an intersection among the primitives [first, first + count), and
+    // returns whether one did.
+    template <typename LeafOccluded>
+    bool occluded(const ray& r, real t_min, real t_max, LeafOccluded&& leaf_occluded) const;
+
+public:
+    std::vector<linear_bvh_node> nodes;
+};
+
+class bvh : public hittable {
+public:
+    bvh() {}
+    bvh(const hittable_list& list, bvh_build method = bvh_build::sah);
+
+    virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+    virtual bool bounding_box(aabb& output_box) const;
+    virtual bool occluded(const ray& r, real tmin, real tmax) const;
+
+public:
+    linear_bvh tree;
+    std::vector<shared_ptr<hittable>> objects; // in leaf order
+};
+
+inline bool hit_node(const linear_bvh_node& node, const point3& orig, const vec3& inv_dir, real t_min, real t_max) {
+    // Widening the far ends by 2 gamma(3) keeps the test conservative under
+    // rounding, so boxes the ray only touches are entered too (Ize 2013).
+    const real far_scale = 1 + 2 * error_gamma(3);
+    for (int a = 0; a < 3; ++a) {
+        auto t0 = (node.bounds_min[a] - orig[a]) * inv_dir[a];
+        auto t1 = (node.bounds_max[a] - orig[a]) * inv_dir[a];
+        if (inv_dir[a] < 0.0) std::swap(t0, t1);
+        t1 *= far_scale;
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+        if (t_max < t_min) return false;
+    }
+    return true;
+}
+
+template <typename LeafHit>
+bool linear_bvh::traverse(const ray& r, real t_min, real t_max, LeafHit&& leaf_hit) const {
+    if (nodes.empty())
+        return false;
+
+    vec3 inv_dir(1.0 / r.dir.x(), 1.0 / r.dir.y(), 1.0 / r.dir.z());
+    bool dir_is_neg[3] = { inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0 };
+
+    uint32_t stack[stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+
+    while (true) {
+        const auto& node = nodes[current];
+        if (hit_node(node, r.orig, inv_dir, t_min, t_max)) {
+            if (node.count > 0) {
+                if (leaf_hit(node.offset, node.count, t_max))
+                    hit_anything = true;
+            } else {
+                // Descend into the near child, defer the far one.
+                if (dir_is_neg[node.axis]) {
+                    stack[stack_top++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_top++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (stack_top == 0)
+            break;
+        current = stack[--stack_top];
+    }
+
+    return hit_anything;
+}
+
+template <typename LeafOccluded>
+bool linear_bvh::occluded(const ray& r, real t_min, real t_max, LeafOccluded&& leaf_occluded) const {
+    if (nodes.empty())
+        return false;
+
+    vec3 inv_dir(1.0 / r.dir.x(), 1.0 / r.dir.y(), 1.0 / r.dir.z());
+    bool dir_is_neg[3] = { inv_dir.x() < 0, inv_dir.y() < 0, inv_dir.z() < 0 };
+
+    uint32_t stack[stack_size];
+    int stack_top = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const auto& node = nodes[current];
+        if (hit_node(node, r.orig, inv_dir, t_min, t_max)) {
+            if (node.count > 0) {
+                if (leaf_occluded(node.offset, node.count))
+                    return true;
+            } else {
+                // Any hit will do, but the near child is still the likelier one.
+                if (dir_is_neg[node.axis]) {
+                    stack[stack_top++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_top++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+        if (stack_top == 0)
+            break;
+        current = stack[--stack_top];
+    }
+
+    return false;
+}
@@ -0,0 +1,229 @@
+#include "bvh_cache.h"
+#include "mapped_file.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+// Bumped whenever the file layout, the node layout or the build changes,
+// so that older caches are ignored.
+const uint32_t cache_version = 2;
+const char cache_magic[8] = { 'R', 'T', 'B', 'V', 'H', 'C', 'A', 'C' };
+
+using cached_node = wide_bvh_node<8>;
+
+// Precedes the nodes and then the triangle indices in leaf order. Its size
+// is a multiple of the node alignment, so the nodes stay aligned in the
+// mapped file.
+struct cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size;
+    uint64_t hash;
+    uint64_t checksum;      // of the nodes and indices that follow
+    uint64_t vertices;
+    uint64_t triangles;
+    uint64_t nodes;
+    float box_min[3];
+    float box_max[3];
+    uint32_t padding[4];
+};
+
+static_assert(sizeof(cache_header) % alignof(cached_node) == 0, "cache_header must keep the nodes aligned");
+
+std::string& cache_directory() {
+    static std::string directory;
+    return directory;
+}
+
+// A 64-bit hash of a stream of bytes, taken eight at a time. Fast rather
+// than cryptographic: it only has to tell meshes apart.
+class geometry_hash {
+public:
+    void add(const void* data, size_t bytes) {
+        auto p = static_cast<const char*>(data);
+        for (; bytes >= 8; p += 8, bytes -= 8) {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            mix(word);
+        }
+        if (bytes > 0) {
+            uint64_t word = 0;
+            memcpy(&word, p, bytes);
+            mix(word ^ (uint64_t(bytes) << 56));
+        }
+    }
+
+    template <typename T>
+    void add(const T& value) { add(&value, sizeof(value)); }
+
+    // The murmur3 finalizer, so every bit of the state reaches every bit of
+    // the result.
+    uint64_t value() const {
+        auto h = state;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+private:
+    void mix(uint64_t word) {
+        state ^= word * 0x87c37b91114253d5ull;
+        state = (state << 31 | state >> 33) * 0x4cf5ad432745937full;
+    }
+
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+};
+
+uint64_t hash_geometry(const triangle_mesh& mesh, bvh_build method) {
+    geometry_hash h;
+    h.add(cache_version);
+    h.add(static_cast<uint32_t>(method));
+    h.add(static_cast<uint32_t>(sizeof(real)));
+    h.add(static_cast<uint64_t>(mesh.vertex_count()));
+    h.add(static_cast<uint64_t>(mesh.size()));
+    if (mesh.position_stride() == 3 * sizeof(float)) {
+        h.add(mesh.position_data(), 3 * sizeof(float) * mesh.vertex_count());
+    } else {
+        for (size_t v = 0; v < mesh.vertex_count(); ++v)
+            h.add(mesh.position_data() + mesh.position_stride() * v, 3 * sizeof(float));
+    }
+    h.add(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+    return h.value();
+}
+
+std::string cache_path(uint64_t hash) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bvh", static_cast<unsigned long long>(hash));
+    return (std::filesystem::path(cache_directory()) / name).string();
+}
+
+// The checksum stored with the nodes and indices, so a damaged file is
+// rebuilt rather than trusted.
+uint64_t payload_checksum(const std::vector<cached_node>& nodes, const std::vector<uint32_t>& indices) {
+    geometry_hash h;
+    h.add(nodes.data(), nodes.size() * sizeof(cached_node));
+    h.add(indices.data(), indices.size() * sizeof(uint32_t));
+    return h.value();
+}
+
+// Whether nodes and indices can be traversed safely over vertices: leaf
+// ranges lie within the triangles, interior children come after their
+// parent so traversal cannot loop, and indices name existing vertices.
+// Empty slots, whose bounds no ray enters, are not followed.
+bool valid_payload(const std::vector<cached_node>& nodes, const std::vector<uint32_t>& indices, size_t vertices) {
+    auto triangles = indices.size() / 3;
+    if (nodes.empty() != (triangles == 0))
+        return false;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const auto& node = nodes[i];
+        for (int k = 0; k < 8; ++k) {
+            if (!(node.min_x[k] <= node.max_x[k]))
+                continue;
+            if (node.count[k] > 0 ? size_t(node.child[k]) + node.count[k] > triangles
+                : node.child[k] <= i || node.child[k] >= nodes.size())
+                return false;
+        }
+    }
+    for (auto v : indices) {
+        if (v >= vertices)
+            return false;
+    }
+    return true;
+}
+
+bool read_cache(const std::string& path, uint64_t hash, triangle_mesh& mesh) {
+    mapped_file file(path.c_str());
+    if (!file.is_open() || file.size() < sizeof(cache_header))
+        return false;
+    cache_header header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version
+        || header.node_size != sizeof(cached_node) || header.hash != hash
+        || header.vertices != mesh.vertex_count() || header.triangles != mesh.size())
+        return false;
+    auto node_bytes = header.nodes * sizeof(cached_node);
+    auto index_bytes = 3 * header.triangles * sizeof(uint32_t);
+    if (file.size() != sizeof(header) + node_bytes + index_bytes)
+        return false;
+
+    const char* p = file.data() + sizeof(header);
+    std::vector<cached_node> nodes(header.nodes);
+    std::vector<uint32_t> indices(3 * header.triangles);
+    memcpy(nodes.data(), p, node_bytes);
+    memcpy(indices.data(), p + node_bytes, index_bytes);
+    if (payload_checksum(nodes, indices) != header.checksum || !valid_payload(nodes, indices, mesh.vertex_count()))
+        return false;
+    mesh.tree.nodes.swap(nodes);
+    mesh.indices.swap(indices);
+    mesh.box = aabb(point3(header.box_min[0], header.box_min[1], header.box_min[2]),
+        point3(header.box_max[0], header.box_max[1], header.box_max[2]));
+    return true;
+}
+
+// Writes to a temporary file renamed into place at the end, so a run that
+// stops halfway or races another never leaves a torn cache behind.
+bool write_cache(const std::string& path, uint64_t hash, const triangle_mesh& mesh) {
+    std::error_code error;
+    std::filesystem::create_directories(cache_directory(), error);
+    if (error)
+        return false;
+
+    cache_header header = {};
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.node_size = sizeof(cached_node);
+    header.hash = hash;
+    header.vertices = mesh.vertex_count();
+    header.triangles = mesh.size();
+    header.nodes = mesh.tree.nodes.size();
+    header.checksum = payload_checksum(mesh.tree.nodes, mesh.indices);
+    for (int a = 0; a < 3; ++a) {
+        header.box_min[a] = static_cast<float>(mesh.box.min()[a]);
+        header.box_max[a] = static_cast<float>(mesh.box.max()[a]);
+    }
+
+    auto temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(mesh.tree.nodes.data()), mesh.tree.nodes.size() * sizeof(cached_node));
+        out.write(reinterpret_cast<const char*>(mesh.indices.data()), mesh.indices.size() * sizeof(uint32_t));
+        if (!out) {
+            out.close();
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error)
+        std::filesystem::remove(temporary, error);
+    return !error;
+}
+
+}
+
+void set_bvh_cache_directory(const std::string& directory) {
+    cache_directory() = directory;
+}
+
+void build_cached(triangle_mesh& mesh, bvh_build method) {
+    if (cache_directory().empty()) {
+        mesh.build(method);
+        return;
+    }
+    auto hash = hash_geometry(mesh, method);
+    auto path = cache_path(hash);
+    if (read_cache(path, hash, mesh))
+        return;
+    mesh.build(method);
+    if (!write_cache(path, hash, mesh))
+        std::cerr << "cannot write the BVH cache " << path << "\n";
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "triangle_mesh.h"
+
+#include <string>
+
+// Directory in which triangle meshes keep their built hierarchies between
+// runs, created when first written to. Empty, the default, turns the cache
+// off.
+void set_bvh_cache_directory(const std::string& directory);
+
+// Gives mesh the hierarchy and triangle order mesh.build(method) would. A
+// cache file keyed by a hash of the vertices, triangles and build method is
+// memory-mapped and read back instead if there is one; otherwise the mesh is
+// built and the result written for the next run. A cache that cannot be
+// read or written only costs the build.
+void build_cached(triangle_mesh& mesh, bvh_build method);
@@ -6,8 +6,8 @@ class camera {
 public:
     camera(
         point3 lookfrom, point3 lookat, vec3 vup,
-        double vfov, // vertical field-of-view in degrees
-        double aspect_ratio, double aperture, double focus_dist
+        real vfov, // vertical field-of-view in degrees
+        real aspect_ratio, real aperture, real focus_dist
     ) {
         origin = lookfrom;
         lens_radius = aperture / 2;
@@ -28,7 +28,7 @@ public:
         vertical = 2 * half_height * focus_dist * v;
     }
 
-    ray get_ray(double s, double t) const {
+    ray get_ray(real s, real t) const {
         vec3 rd = lens_radius * vec3::random_in_unit_disk();
         vec3 offset = u * rd.x() + v * rd.y();
 
@@ -44,5 +44,5 @@ private:
     vec3 horizontal;
     vec3 vertical;
     vec3 u, v, w;
-    double lens_radius;
+    real lens_radius;
 };
@@ -0,0 +1,333 @@
+// Command-line renderer for machines without a display. Renders one image
+// with the same core as the GUI, writes it as a binary PPM and reports
+// timing and throughput.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+
+#include "rtweekend.h"
+#include "hittable_list.h"
+#include "bvh.h"
+#include "camera.h"
+#include "material.h"
+#include "render.h"
+#include "scene.h"
+#include "obj_loader.h"
+#include "ply_loader.h"
+#include "bvh_cache.h"
+
+namespace {
+
+struct options {
+    scene_kind scene = scene_kind::random;
+    std::string model;      // OBJ or PLY file rendered in place of the scene
+    bool ply = false;
+    std::string output = "image.ppm";
+    int width = 800;
+    int height = 600;
+    int samples = 128;
+    int depth = 64;
+    int roulette = 3;
+    int threads = omp_get_max_threads();
+    int repeat = 1;         // renders timed, the fastest is reported
+    int tile = 32;
+    tile_order order = tile_order::hilbert;
+    int packet = 1;
+    bool wavefront = false;
+    bool progressive = false;
+    double adaptive = 0;    // error threshold, 0 samples every pixel fully
+    accel_structure accel = accel_structure::sphere_batch;
+    bvh_build method = bvh_build::lbvh;
+    bool light_sampling = true;
+    std::string bvh_cache;  // directory for mesh BVHs kept between runs, empty for none
+    // Camera settings left unset come from the scene.
+    std::optional<point3> look_from;
+    std::optional<point3> look_at;
+    std::optional<vec3> view_up;
+    std::optional<double> fov;
+    std::optional<double> aperture;
+    std::optional<double> focus_dist;
+};
+
+void usage(const char* program) {
+    std::cerr <<
+        "usage: " << program << " [options]\n"
+        "  -o, --output FILE      binary PPM to write (image.ppm)\n"
+        "  --scene NAME           random, indoor or mesh (random)\n"
+        "  --obj FILE             render a Wavefront OBJ model instead of a scene\n"
+        "  --ply FILE             render a binary PLY model instead of a scene\n"
+        "  --size WxH             image size (800x600)\n"
+        "  --samples N            samples per pixel (128)\n"
+        "  --depth N              maximum ray depth (64)\n"
+        "  --roulette N           bounces before Russian roulette (3)\n"
+        "  --threads N            render threads (all)\n"
+        "  --repeat N             render N times and report the fastest (1)\n"
+        "  --tile N               tile size in pixels (32)\n"
+        "  --order NAME           scanline, spiral or hilbert (hilbert)\n"
+        "  --packet N             trace camera rays in packets of 1, 4, 8 or 16 (1)\n"
+        "  --integrator NAME      path or wavefront (path)\n"
+        "  --progressive          render one sample per pixel per pass\n"
+        "  --adaptive T           stop pixels whose error drops below T\n"
+        "  --accel NAME           bvh, bvh4, bvh8 or batch (batch)\n"
+        "  --bvh NAME             sah or lbvh (lbvh)\n"
+        "  --bvh-cache DIR        keep built mesh BVHs in DIR for later runs\n"
+        "  --no-light-sampling    trace paths without next-event estimation\n"
+        "camera options default to the view the scene suggests:\n"
+        "  --look-from X,Y,Z      camera position\n"
+        "  --look-at X,Y,Z        camera target\n"
+        "  --up X,Y,Z             camera up vector\n"
+        "  --fov DEGREES          vertical field of view\n"
+        "  --aperture A           lens aperture\n"
+        "  --focus-dist D         focus distance\n";
+}
+
+bool parse_vec3(const char* text, std::optional<vec3>& v) {
+    double x, y, z;
+    if (sscanf(text, "%lf,%lf,%lf", &x, &y, &z) != 3)
+        return false;
+    v = vec3(x, y, z);
+    return true;
+}
+
+// Returns the index of name in the '\0'-separated list names, or -1.
+int parse_choice(const char* name, const char* names) {
+    for (int i = 0; *names; ++i, names += strlen(names) + 1) {
+        if (strcmp(name, names) == 0)
+            return i;
+    }
+    return -1;
+}
+
+bool parse_options(int argc, char** argv, options& opt) {
+    for (int k = 1; k < argc; ++k) {
+        std::string arg = argv[k];
+        if (arg == "-h" || arg == "--help")
+            return false;
+        if (arg == "--progressive") {
+            opt.progressive = true;
+            continue;
+        }
+        if (arg == "--no-light-sampling") {
+            opt.light_sampling = false;
+            continue;
+        }
+        if (k + 1 >= argc) {
+            std::cerr << "missing value for " << arg << "\n";
+            return false;
+        }
+        const char* value = argv[++k];
+        bool ok = true;
+        if (arg == "-o" || arg == "--output") {
+            opt.output = value;
+        } else if (arg == "--scene") {
+            auto i = parse_choice(value, "random\0indoor\0mesh\0");
+            opt.scene = static_cast<scene_kind>(i);
+            ok = i >= 0;
+        } else if (arg == "--obj" || arg == "--ply") {
+            opt.model = value;
+            opt.ply = arg == "--ply";
+        } else if (arg == "--size") {
+            ok = sscanf(value, "%dx%d", &opt.width, &opt.height) == 2 && opt.width > 1 && opt.height > 1;
+        } else if (arg == "--samples") {
+            opt.samples = atoi(value);
+            ok = opt.samples > 0;
+        } else if (arg == "--depth") {
+            opt.depth = atoi(value);
+            ok = opt.depth > 0;
+        } else if (arg == "--roulette") {
+            opt.roulette = atoi(value);
+            ok = opt.roulette >= 0;
+        } else if (arg == "--threads") {
+            opt.threads = atoi(value);
+            ok = opt.threads > 0;
+        } else if (arg == "--repeat") {
+            opt.repeat = atoi(value);
+            ok = opt.repeat > 0;
+        } else if (arg == "--tile") {
+            opt.tile = atoi(value);
+            ok = opt.tile > 0;
+        } else if (arg == "--order") {
+            auto i = parse_choice(value, "scanline\0spiral\0hilbert\0");
+            opt.order = static_cast<tile_order>(i);
+            ok = i >= 0;
+        } else if (arg == "--packet") {
+            opt.packet = atoi(value);
+            ok = opt.packet == 1 || opt.packet == 4 || opt.packet == 8 || opt.packet == 16;
+        } else if (arg == "--integrator") {
+            auto i = parse_choice(value, "path\0wavefront\0");
+            opt.wavefront = i == 1;
+            ok = i >= 0;
+        } else if (arg == "--adaptive") {
+            opt.adaptive = atof(value);
+            ok = opt.adaptive > 0;
+        } else if (arg == "--accel") {
+            auto i = parse_choice(value, "bvh\0bvh4\0bvh8\0batch\0");
+            opt.accel = static_cast<accel_structure>(i);
+            ok = i >= 0;
+        } else if (arg == "--bvh") {
+            auto i = parse_choice(value, "sah\0lbvh\0");
+            opt.method = static_cast<bvh_build>(i);
+            ok = i >= 0;
+        } else if (arg == "--bvh-cache") {
+            opt.bvh_cache = value;
+        } else if (arg == "--look-from") {
+            ok = parse_vec3(value, opt.look_from);
+        } else if (arg == "--look-at") {
+            ok = parse_vec3(value, opt.look_at);
+        } else if (arg == "--up") {
+            ok = parse_vec3(value, opt.view_up);
+        } else if (arg == "--fov") {
+            opt.fov = atof(value);
+        } else if (arg == "--aperture") {
+            opt.aperture = atof(value);
+        } else if (arg == "--focus-dist") {
+            opt.focus_dist = atof(value);
+        } else {
+            std::cerr << "unknown option " << arg << "\n";
+            return false;
+        }
+        if (!ok) {
+            std::cerr << "bad value for " << arg << ": " << value << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Memory the process holds in RAM, in bytes, or 0 where that is unknown.
+// Pages of mapped files count once they have been read.
+size_t resident_bytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+    return 0;
+#elif defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+#else
+    return 0;
+#endif
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    options opt;
+    if (!parse_options(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+    omp_set_num_threads(opt.threads);
+    set_bvh_cache_directory(opt.bvh_cache);
+
+    material_table materials;
+    hittable_list world;
+    scene_view view{};
+    double build_seconds = 0;
+    if (!opt.model.empty()) {
+        // Loading and building are timed apart, to see which of them a big
+        // model waits on.
+        auto mesh = make_shared<triangle_mesh>();
+        auto load_start = std::chrono::steady_clock::now();
+        if (!(opt.ply ? load_ply(opt.model.c_str(), *mesh) : load_obj(opt.model.c_str(), *mesh)))
+            return 1;
+        if (mesh->size() == 0) {
+            std::cerr << opt.model << " holds no triangles\n";
+            return 1;
+        }
+        auto load_seconds = seconds_since(load_start);
+        auto mesh_start = std::chrono::steady_clock::now();
+        build_cached(*mesh, opt.method);
+        auto mesh_seconds = seconds_since(mesh_start);
+        build_seconds += mesh_seconds;
+        auto megabytes = std::ifstream(opt.model, std::ios::binary | std::ios::ate).tellg() * 1e-6;
+        printf("model   %zu triangles, %zu vertices, %.1f MB loaded in %.1f ms (%.0f MB/s), bvh %.1f ms\n",
+            mesh->size(), mesh->vertex_count(), megabytes, 1000 * load_seconds, megabytes / load_seconds, 1000 * mesh_seconds);
+        view = model_scene(mesh, world, materials);
+    }
+
+    auto build_start = std::chrono::steady_clock::now();
+    if (opt.model.empty())
+        view = make_scene(opt.scene, world, materials);
+    light_list lights(world, materials);
+    auto world_accel = build_accel(world, opt.accel, opt.method);
+    build_seconds += seconds_since(build_start);
+    auto resident = resident_bytes();
+
+    camera cam(opt.look_from.value_or(view.look_from), opt.look_at.value_or(view.look_at),
+        opt.view_up.value_or(view.view_up), opt.fov.value_or(view.fov), double(opt.width) / opt.height,
+        opt.aperture.value_or(view.aperture), opt.focus_dist.value_or(view.focus_dist));
+    render_settings settings = {
+        opt.width, opt.height, opt.samples, opt.depth, opt.roulette, view.sky, opt.light_sampling,
+        opt.threads, opt.tile, opt.order, opt.progressive,
+        opt.adaptive > 0, opt.adaptive, false, opt.packet, opt.wavefront
+    };
+    std::vector<unsigned char> image(3 * size_t(opt.width) * opt.height);
+    std::vector<pixel_state> pixels(size_t(opt.width) * opt.height);
+    std::vector<float> utilization(opt.threads);
+    render_counters counters;
+    const std::atomic<bool> never{ false };
+
+    // Every repeat starts over from cleared pixels and counters, and renders
+    // the same image; only the fastest time is kept.
+    double render_seconds = std::numeric_limits<double>::infinity();
+    for (int k = 0; k < opt.repeat; ++k) {
+        std::fill(pixels.begin(), pixels.end(), pixel_state());
+        counters.reset();
+        auto render_start = std::chrono::steady_clock::now();
+        render(*world_accel, materials, lights, cam, settings, image.data(), pixels.data(), counters, utilization.data(), never);
+        render_seconds = std::min(render_seconds, seconds_since(render_start));
+    }
+
+    std::ofstream out(opt.output, std::ios::binary);
+    out << "P6\n" << opt.width << ' ' << opt.height << "\n255\n";
+    out.write(reinterpret_cast<const char*>(image.data()), image.size());
+    if (!out) {
+        std::cerr << "cannot write " << opt.output << "\n";
+        return 1;
+    }
+
+    double busy = 0;
+    for (auto u : utilization)
+        busy += u / opt.threads;
+    printf("scene   %zu objects, %zu lights, build %.1f ms, %.1f MB resident\n", world.objects.size(), lights.size(),
+        1000 * build_seconds, resident * 1e-6);
+    printf("render  %.3f s on %d threads, utilization %.0f%%", render_seconds, opt.threads, 100 * busy);
+    if (opt.repeat > 1)
+        printf(", fastest of %d", opt.repeat);
+    printf("\n");
+    printf("samples %lld (%.1f per pixel), %.3f M/s\n", (long long)counters.samples.load(),
+        double(counters.samples) / pixels.size(), counters.samples / render_seconds * 1e-6);
+    printf("rays    %lld (%.2f per sample), %.3f Mrays/s\n", (long long)counters.rays.load(),
+        double(counters.rays) / counters.samples, counters.rays / render_seconds * 1e-6);
+    printf("bounces %lld (%.2f per sample)\n", (long long)counters.bounces.load(), double(counters.bounces) / counters.samples);
+    return 0;
+}
@@ -1,22 +1,66 @@
 #pragma once
 
 #include "ray.h"
-class material;
+#include "aabb.h"
+
+#include <cstdint>
 
 struct hit_record {
     point3 p;
-    vec3 normal;
-    shared_ptr<material> mat_ptr;
-    double t;
+    vec3 p_error;       // bound on the absolute rounding error of each coordinate of p
+    vec3 normal;            // shading normal, facing the incoming ray
+    vec3 geometric_normal;  // normal of the surface itself, on the same side
+    uint32_t mat_id;    // index into the scene's material_table
+    real t;
     bool front_face;
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
         normal = front_face ? outward_normal : -outward_normal;
+        geometric_normal = normal;
+    }
+
+    // Ray leaving the surface in direction dir. Its origin is p pushed along
+    // the geometric normal just past p_error, on the side dir points to, so
+    // rounding cannot put it back behind the surface it starts on. A shading
+    // normal would not do: dir can be in front of it yet behind the surface.
+    inline ray spawn_ray(const vec3& dir) const {
+        const vec3& n = geometric_normal;
+        auto d = fabs(n.x()) * p_error.x() + fabs(n.y()) * p_error.y() + fabs(n.z()) * p_error.z();
+        vec3 offset = dot(dir, n) < 0 ? -d * n : d * n;
+        point3 origin = p + offset;
+        // The addition may round back towards p; step one ulp further out.
+        for (int i = 0; i < 3; ++i) {
+            if (offset[i] > 0)
+                origin[i] = next_real_up(origin[i]);
+            else if (offset[i] < 0)
+                origin[i] = next_real_down(origin[i]);
+        }
+        return ray(origin, dir);
     }
 };
 
+// Most rays hittable::hit_packet traces at once.
+const int max_packet_size = 16;
+
 class hittable {
 public:
-    virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+    virtual bool hit(const ray& r, real t_min, real t_max, hit_record& rec) const = 0;
+    virtual bool bounding_box(aabb& output_box) const = 0;
+
+    // Whether anything lies along r within (t_min, t_max). Stops at the
+    // first intersection found and fills in no hit record, which makes it
+    // the cheap query for shadow rays.
+    virtual bool occluded(const ray& r, real t_min, real t_max) const {
+        hit_record rec;
+        return hit(r, t_min, t_max, rec);
+    }
+
+    // hit() for count <= max_packet_size rays, such as the camera rays of
+    // neighbouring pixels; hits[k] tells whether rays[k] hit and recs[k]
+    // where. Structures that can trace coherent rays together override it.
+    virtual void hit_packet(const ray* rays, int count, real t_min, real t_max, hit_record* recs, bool* hits) const {
+        for (int k = 0; k < count; ++k)
+            hits[k] = hit(rays[k], t_min, t_max, recs[k]);
+    }
 };
@@ -16,7 +16,9 @@ public:
     void clear() { objects.clear(); }
     void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
-    virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+    virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+    virtual bool bounding_box(aabb& output_box) const;
+    virtual bool occluded(const ray& r, real tmin, real tmax) const;
 
 public:
     std::vector<shared_ptr<hittable>> objects;
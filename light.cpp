@@ -0,0 +1,89 @@
+#include "light.h"
+#include "sphere.h"
+
+#include <algorithm>
+
+namespace {
+
+// 1 - cos of the half angle of the cone a sphere subtends, written so it
+// keeps its precision for small, distant lights.
+real cone_one_minus_cos(real radius_squared, real distance_squared) {
+    auto sin_squared = radius_squared / distance_squared;
+    return sin_squared / (1 + sqrt(1 - sin_squared));
+}
+
+}
+
+light_list::light_list(const hittable_list& world, const material_table& materials) {
+    for (const auto& object : world.objects) {
+        auto s = std::dynamic_pointer_cast<sphere>(object);
+        if (!s)
+            continue;
+        const auto& m = materials[s->mat_id];
+        if (m.type == material::kind::diffuse_light) {
+            center.push_back(s->center);
+            radius.push_back(s->radius);
+            mat_id.push_back(s->mat_id);
+            emit.push_back(m.as_diffuse_light.emit);
+        }
+    }
+}
+
+bool light_list::sample(const point3& p, vec3& dir, size_t& light) const {
+    auto k = std::min(static_cast<size_t>(random_double() * size()), size() - 1);
+    vec3 to_center = center[k] - p;
+    auto distance_squared = to_center.length_squared();
+    auto radius_squared = radius[k] * radius[k];
+    if (distance_squared <= radius_squared)
+        return false;
+
+    // Uniform over the cone, in a frame whose w axis points at the center.
+    auto z = 1 - random_double() * cone_one_minus_cos(radius_squared, distance_squared);
+    auto phi = 2 * pi * random_double();
+    auto r = sqrt(fmax(real(0), 1 - z * z));
+
+    vec3 w = unit_vector(to_center);
+    vec3 a = fabs(w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+    vec3 v = unit_vector(cross(w, a));
+    vec3 u = cross(w, v);
+    dir = r * cos(phi) * u + r * sin(phi) * v + z * w;
+    light = k;
+    return true;
+}
+
+real light_list::distance(const ray& r, size_t light) const {
+    // The near intersection with the light; directions at the rim of the
+    // cone may just miss it by rounding and are taken as grazing it.
+    real near, far;
+    if (sphere_roots(r, center[light], radius[light], near, far))
+        return near;
+    return dot(center[light] - r.orig, r.dir) / r.dir.length_squared();
+}
+
+real light_list::pdf(const point3& p, const vec3& dir, size_t light) const {
+    vec3 to_center = center[light] - p;
+    auto distance_squared = to_center.length_squared();
+    auto radius_squared = radius[light] * radius[light];
+    if (distance_squared <= radius_squared)
+        return 0;
+    auto one_minus_cos = cone_one_minus_cos(radius_squared, distance_squared);
+    if (dot(dir, to_center) < (1 - one_minus_cos) * sqrt(distance_squared))
+        return 0;
+    return 1 / (2 * pi * one_minus_cos * size());
+}
+
+size_t light_list::find(const hit_record& rec) const {
+    // Lights may share a material, so take the one whose surface is nearest.
+    size_t found = size();
+    real nearest = infinity;
+    for (size_t k = 0; k < size(); ++k) {
+        if (mat_id[k] != rec.mat_id)
+            continue;
+        auto gap = fabs((rec.p - center[k]).length() - radius[k]);
+        if (gap < nearest) {
+            nearest = gap;
+            found = k;
+        }
+    }
+    return found;
+}
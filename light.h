@@ -0,0 +1,40 @@
+#pragma once
+
+#include "rtweekend.h"
+#include "hittable_list.h"
+#include "material.h"
+
+#include <cstdint>
+#include <vector>
+
+// The emissive spheres of a scene, sampled for next-event estimation. A
+// light is picked uniformly, then a direction within the cone it subtends
+// from the shading point. Each light is estimated on its own, so a shadow
+// ray only has to show that nothing lies between the point and the light.
+class light_list {
+public:
+    light_list() {}
+    // Collects the spheres of world whose material is a diffuse_light.
+    light_list(const hittable_list& world, const material_table& materials);
+
+    bool empty() const { return center.empty(); }
+    size_t size() const { return center.size(); }
+
+    // Picks a light and a unit direction from p towards it; false if p lies
+    // inside the chosen light.
+    bool sample(const point3& p, vec3& dir, size_t& light) const;
+    // How far along r the surface of light is. Taken from the shadow ray
+    // itself, whose origin spawn_ray has moved off p.
+    real distance(const ray& r, size_t light) const;
+    // Density of sample() choosing light and the unit vector dir from p, per
+    // solid angle.
+    real pdf(const point3& p, const vec3& dir, size_t light) const;
+    // The light whose surface rec lies on, or size() if it is none of them.
+    size_t find(const hit_record& rec) const;
+
+public:
+    std::vector<point3> center;
+    std::vector<real> radius;
+    std::vector<uint32_t> mat_id;
+    std::vector<color> emit;
+};
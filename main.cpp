@@ -1,5 +1,7 @@
 ﻿#include <iostream>
+#include <algorithm>
 #include <thread>
+#include <atomic>
 #include <chrono>
 
 #include <glad/glad.h> 
@@ -9,60 +11,51 @@
 
 #include "imgui/imgui_impl_glfw.h"
 #include "imgui/imgui_impl_opengl3.h"
+#include "imgui/imgui_internal.h"
 
 #include "rtweekend.h"
 #include "hittable_list.h"
-#include "sphere.h"
+#include "bvh.h"
 #include "color.h"
 #include "camera.h"
 #include "material.h"
+#include "render.h"
+#include "scene.h"
+#include "bvh_cache.h"
 
 using namespace std::chrono_literals;
 
-color ray_color(const ray& r, const hittable& world, int depth) {
-    hit_record rec;
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0, 0, 0);
-
-    if (world.hit(r, epsilon, infinity, rec)) {
-        ray scattered;
-        color attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-            return attenuation * ray_color(scattered, world, depth - 1);
-        return color(0, 0, 0);
-    }
-    vec3 unit_direction = unit_vector(r.direction());
-    auto t = 0.5 * (unit_direction.y() + 1.0);
-    return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+// Greys out the widgets up to the matching end_disabled and ignores input to
+// them while disabled is true; this ImGui predates BeginDisabled.
+void begin_disabled(bool disabled)
+{
+    ImGui::PushItemFlag(ImGuiItemFlags_Disabled, disabled);
+    ImGui::PushStyleVar(ImGuiStyleVar_Alpha, ImGui::GetStyle().Alpha * (disabled ? 0.5f : 1.0f));
 }
 
-void do_render(const hittable_list& world, const camera& cam, int image_width, int image_height, unsigned char* image_data, int samples_per_pixel, int max_depth, bool& finish)
+void end_disabled()
 {
-    std::thread render([&world, &cam, image_width, image_height, image_data, samples_per_pixel, max_depth, &finish]() {
-        #pragma omp parallel for
-        for (int j = 0; j < image_height; ++j) {
-            //std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-            for (int i = 0; i < image_width; ++i) {
-                color pixel_color(0, 0, 0);
-                for (int s = 0; s < samples_per_pixel; ++s) {
-                    auto u = (i + random_double()) / (image_width - 1);
-                    auto v = (image_height - 1 - j + random_double()) / (image_height - 1);
-                    ray r = cam.get_ray(u, v);
-                    pixel_color += ray_color(r, world, max_depth);
-                }
-                write_color(&image_data[3 * (j * image_width + i)], pixel_color, samples_per_pixel);
-            }
-            if (finish) break;
-        }
+    ImGui::PopStyleVar();
+    ImGui::PopItemFlag();
+}
 
-        finish = true;
+// Runs render on a thread of its own. running stays set until the render
+// returns, which it does early once cancel is set; until then the scene and
+// the buffers must be left alone, and the thread joined after.
+std::thread do_render(const hittable& world, const material_table& materials, const light_list& lights, const camera& cam, const render_settings& settings, unsigned char* image_data, pixel_state* pixels, render_counters& counters, float* utilization, const std::atomic<bool>& cancel, std::atomic<bool>& running)
+{
+    running = true;
+    return std::thread([&world, &materials, &lights, cam, settings, image_data, pixels, &counters, utilization, &cancel, &running]() {
+        render(world, materials, lights, cam, settings, image_data, pixels, counters, utilization, cancel);
+        running = false;
     });
-    render.detach();
 }
 
 int main(void)
 {
+    // Mesh scenes reuse the hierarchies of earlier runs.
+    set_bvh_cache_directory("bvh_cache");
+
     /* Initialize the library */
     if (!glfwInit())
         return 1;
@@ -80,6 +73,7 @@ int main(void)
 
     int image_size[2] = { 800, 600 };
     std::vector<unsigned char> image(image_size[0] * image_size[1] * 3);
+    std::vector<pixel_state> pixels(image_size[0] * image_size[1]);
 
     // Create a OpenGL texture identifier
     GLuint image_texture;
@@ -102,45 +96,65 @@ int main(void)
     ImGui_ImplOpenGL3_Init();
 
     bool show_demo_window = false;
-    bool render_finish = true;
+    std::thread render_thread;
+    std::atomic<bool> render_cancel{ false };
+    std::atomic<bool> render_running{ false };
     auto render_start = std::chrono::system_clock::now();
     int render_time = 0;
     int render_threads = omp_get_max_threads();
     int render_samples = 128;
     int render_depth = 64;
+    int render_roulette = 3;
+    int render_tile = 32;
+    int render_order = static_cast<int>(tile_order::hilbert);
+    int render_packet = 0;  // index into 1, 4, 8, 16 camera rays per packet
+    int render_integrator = 0;  // 0 path by path, 1 wavefront
+    std::vector<float> render_utilization(omp_get_num_procs(), 0.0f);
+    bool render_progressive = true;
+    render_counters render_progress;
+    bool render_adaptive = true;
+    float render_threshold = 0.01f;
+    bool render_heatmap = false;
+    bool render_sky = true;
+    bool render_light_sampling = true;
     int look_from[3] = { 13, 2, 3 };
     int look_to[3] = { 0, 0, 0 };
     int view_up[3] = { 0, 1, 0 };
     int view_fov = 20;
     float cam_aperture = 0.1;
     float cam_focus_dist = 10.0;
+    int scene = static_cast<int>(scene_kind::random);
+    int bvh_method = static_cast<int>(bvh_build::lbvh);
+    int world_accel = static_cast<int>(accel_structure::sphere_batch);
+    double bvh_time = 0;
 
+    material_table materials;
     hittable_list world;
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
-    for (int a = -11; a < 11; ++a) {
-        for (int b = -11; b < 11; ++b) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-            if ((center - vec3(4, 0.2, 0)).length() > 0.9) {
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    world.add(make_shared<sphere>(center, 0.2, make_shared<lambertian>(albedo)));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(.5, 1);
-                    auto fuzz = random_double(0, .5);
-                    world.add(make_shared<sphere>(center, 0.2, make_shared<metal>(albedo, fuzz)));
-                } else {
-                    // glass
-                    world.add(make_shared<sphere>(center, 0.2, make_shared<dielectric>(1.5)));
-                }
-            }
+    light_list lights;
+    shared_ptr<hittable> world_bvh;
+    auto build_bvh = [&]() {
+        auto build_start = std::chrono::steady_clock::now();
+        world_bvh = build_accel(world, static_cast<accel_structure>(world_accel), static_cast<bvh_build>(bvh_method));
+        bvh_time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_start).count();
+    };
+    // Replaces the scene and moves the camera to where the scene suggests.
+    auto load_scene = [&]() {
+        world.clear();
+        materials = material_table();
+        auto view = make_scene(static_cast<scene_kind>(scene), world, materials);
+        lights = light_list(world, materials);
+        for (int k = 0; k < 3; ++k) {
+            look_from[k] = static_cast<int>(view.look_from[k]);
+            look_to[k] = static_cast<int>(view.look_at[k]);
+            view_up[k] = static_cast<int>(view.view_up[k]);
         }
-    }
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, make_shared<dielectric>(1.5)));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, make_shared<lambertian>(color(.4, .2, .1))));
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, make_shared<metal>(color(.7, .6, .5), 0.0)));
+        view_fov = static_cast<int>(view.fov);
+        cam_aperture = static_cast<float>(view.aperture);
+        cam_focus_dist = static_cast<float>(view.focus_dist);
+        render_sky = view.sky;
+        build_bvh();
+    };
+    load_scene();
 
     // Main loop
     while (!glfwWindowShouldClose(window))
@@ -153,41 +167,141 @@ int main(void)
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
+        // A finished render is joined here, and only then may the scene or
+        // the buffers it used change.
+        bool render_done = false;
+        if (render_thread.joinable() && !render_running) {
+            render_thread.join();
+            render_done = true;
+        }
+        bool rendering = render_thread.joinable();
+
         ImGui::Begin("Ray Tracing In One Weekend");
-        if (ImGui::Button("Render")) {
-            render_finish = false;
+        begin_disabled(rendering);
+        bool start_render = ImGui::Button("Render") && !rendering;
+        ImGui::SameLine();
+        // Continue keeps the accumulated samples and renders up to the current sample count.
+        bool continue_render = ImGui::Button("Continue") && !rendering && render_progress.samples > 0;
+        end_disabled();
+        ImGui::SameLine();
+        // Stop keeps what has been rendered, to be continued later.
+        begin_disabled(!rendering);
+        if (ImGui::Button("Stop") && rendering)
+            render_cancel = true;
+        end_disabled();
+        render_settings settings = {
+            image_size[0], image_size[1], render_samples, render_depth, render_roulette, render_sky, render_light_sampling,
+            render_threads, render_tile, static_cast<tile_order>(render_order), render_progressive,
+            render_adaptive, render_threshold, render_heatmap, render_packet > 0 ? 2 << render_packet : 1,
+            render_integrator == 1
+        };
+        if (start_render || continue_render) {
+            if (start_render) {
+                std::fill(pixels.begin(), pixels.end(), pixel_state());
+                render_progress.reset();
+            }
+            render_cancel = false;
             render_start = std::chrono::system_clock::now();
-            do_render(world, camera(
+            std::fill(render_utilization.begin(), render_utilization.end(), 0.0f);
+            render_thread = do_render(*world_bvh, materials, lights, camera(
                 point3(look_from[0], look_from[1], look_from[2]),
                 point3(look_to[0], look_to[1], look_to[2]),
                 point3(view_up[0], view_up[1], view_up[2]),
-                view_fov, double(image_size[0]) / image_size[1], 0.1, 10.0),
-                image_size[0], image_size[1], image.data(), render_samples, render_depth, render_finish);
+                view_fov, double(image_size[0]) / image_size[1], cam_aperture, cam_focus_dist),
+                settings, image.data(), pixels.data(), render_progress, render_utilization.data(), render_cancel, render_running);
+            rendering = true;
         }
         ImGui::SameLine();
-        ImGui::Text("time = %ds", render_time);
+        ImGui::Text("time = %ds, pass = %d", render_time, render_progress.passes.load());
         ImGui::SameLine();
-        if (ImGui::Button("Clear")) {
-            render_finish = true;
+        begin_disabled(rendering);
+        bool clear = ImGui::Button("Clear") && !rendering;
+        end_disabled();
+        if (clear) {
             memset(image.data(), 0, image.size());
+            std::fill(pixels.begin(), pixels.end(), pixel_state());
+            render_progress.reset();
             glBindTexture(GL_TEXTURE_2D, image_texture);
             glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image_size[0], image_size[1], GL_RGB, GL_UNSIGNED_BYTE, image.data());
             glBindTexture(GL_TEXTURE_2D, NULL);
             render_time = 0;
         }
         ImGui::DragInt("samples", &render_samples, 1, 0, INT_MAX);
+        ImGui::SameLine();
+        ImGui::Checkbox("progressive", &render_progressive);
+        ImGui::Checkbox("adaptive", &render_adaptive);
+        ImGui::SameLine();
+        ImGui::DragFloat("threshold", &render_threshold, 0.0005f, 0.0f, 1.0f, "%.4f");
+        ImGui::SameLine();
+        if (ImGui::Checkbox("heatmap", &render_heatmap) && !rendering) {
+            settings.heatmap = render_heatmap;
+            for (size_t k = 0; k < pixels.size(); ++k)
+                write_pixel(&image[3 * k], pixels[k], settings);
+            glBindTexture(GL_TEXTURE_2D, image_texture);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image_size[0], image_size[1], GL_RGB, GL_UNSIGNED_BYTE, image.data());
+            glBindTexture(GL_TEXTURE_2D, NULL);
+        }
+        ImGui::Text("samples/pixel = %.1f", double(render_progress.samples) / pixels.size());
         ImGui::DragInt("depth", &render_depth, 1, 0, INT_MAX);
+        ImGui::SameLine();
+        ImGui::DragInt("roulette after", &render_roulette, 1, 0, INT_MAX);
+        ImGui::SameLine();
+        ImGui::Text("bounces/sample = %.2f", render_progress.samples > 0 ? double(render_progress.bounces) / render_progress.samples : 0.0);
+        ImGui::Checkbox("light sampling", &render_light_sampling);
+        ImGui::SameLine();
+        ImGui::Checkbox("sky", &render_sky);
+        ImGui::SameLine();
+        ImGui::Text("rays/sample = %.2f", render_progress.samples > 0 ? double(render_progress.rays) / render_progress.samples : 0.0);
         if (ImGui::SliderInt("#threads", &render_threads, 1, omp_get_num_procs())) {
             omp_set_num_threads(render_threads);
         }
+        ImGui::DragInt("tile", &render_tile, 1, 1, 512);
+        ImGui::Combo("tile order", &render_order, "scanline\0spiral\0hilbert\0");
+        ImGui::Combo("ray packet", &render_packet, "off\0" "4\0" "8\0" "16\0");
+        ImGui::Combo("integrator", &render_integrator, "path\0wavefront\0");
+        if (!rendering) {
+            float busy = 0, lowest = 1;
+            for (int t = 0; t < render_threads; ++t) {
+                busy += render_utilization[t] / render_threads;
+                lowest = std::min(lowest, render_utilization[t]);
+            }
+            ImGui::PlotHistogram("utilization", render_utilization.data(), render_threads, 0, NULL, 0.0f, 1.0f);
+            ImGui::SameLine();
+            ImGui::Text("avg %.0f%% min %.0f%%", 100 * busy, 100 * lowest);
+        }
+        // The scene, its hierarchy and the image buffers stay as they are
+        // while the render thread uses them.
+        begin_disabled(rendering);
+        if (ImGui::Combo("scene", &scene, "random\0indoor\0mesh\0") && !rendering) {
+            load_scene();
+            memset(image.data(), 0, image.size());
+            std::fill(pixels.begin(), pixels.end(), pixel_state());
+            render_progress.reset();
+            glBindTexture(GL_TEXTURE_2D, image_texture);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image_size[0], image_size[1], GL_RGB, GL_UNSIGNED_BYTE, image.data());
+            glBindTexture(GL_TEXTURE_2D, NULL);
+        }
+        // The combo shows the build in use, so it cannot change mid-render.
+        if (ImGui::Combo("bvh", &bvh_method, "sah\0lbvh\0") && !rendering)
+            build_bvh();
+        if (ImGui::Combo("accel", &world_accel, "bvh\0bvh4\0bvh8\0sphere batch\0") && !rendering)
+            build_bvh();
+        end_disabled();
+        ImGui::SameLine();
+        ImGui::Text("build = %.1fms", bvh_time);
         ImGui::DragInt("fov", &view_fov, 1, 0, 360);
         ImGui::DragFloat("aperture", &cam_aperture);
         ImGui::DragFloat("focut dist", &cam_focus_dist);
         ImGui::DragInt3("look from", look_from);
         ImGui::DragInt3("look at", look_to);
         ImGui::DragInt3("view up", view_up);
-        if (ImGui::DragInt2("size", image_size, 1, 1, INT_MAX)) {
+        begin_disabled(rendering);
+        bool resize = ImGui::DragInt2("size", image_size, 1, 1, INT_MAX) && !rendering;
+        end_disabled();
+        if (resize) {
             image.resize(image_size[0] * image_size[1] * 3);
+            pixels.assign(image_size[0] * image_size[1], pixel_state());
+            render_progress.reset();
             glBindTexture(GL_TEXTURE_2D, image_texture);
             glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image_size[0], image_size[1], 0, GL_RGB, GL_UNSIGNED_BYTE, image.data());
             glBindTexture(GL_TEXTURE_2D, NULL);
@@ -204,7 +318,8 @@ int main(void)
         glClear(GL_COLOR_BUFFER_BIT);
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
-        if (!render_finish) {
+        // The last frame of a render is shown once its thread is done.
+        if (rendering || render_done) {
             glBindTexture(GL_TEXTURE_2D, image_texture);
             glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image_size[0], image_size[1], GL_RGB, GL_UNSIGNED_BYTE, image.data());
             glBindTexture(GL_TEXTURE_2D, NULL);
@@ -217,6 +332,10 @@ int main(void)
         std::this_thread::sleep_for(10ms);
     }
 
+    render_cancel = true;
+    if (render_thread.joinable())
+        render_thread.join();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
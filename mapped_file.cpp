@@ -0,0 +1,98 @@
+#include "mapped_file.h"
+
+#include <utility>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mapped_file::mapped_file(const char* path) {
+#if defined(_WIN32)
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        file = nullptr;
+        return;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        close();
+        return;
+    }
+    length = static_cast<size_t>(file_size.QuadPart);
+    open = true;
+    // An empty file cannot be mapped, but is still a file.
+    if (length == 0)
+        return;
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping)
+        bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!bytes)
+        close();
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        length = static_cast<size_t>(st.st_size);
+        open = true;
+        if (length > 0) {
+            void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                open = false;
+                length = 0;
+            } else {
+                bytes = static_cast<const char*>(p);
+                // Loaders read all of it; start reading it in ahead of them.
+                madvise(p, length, MADV_WILLNEED);
+            }
+        }
+    }
+    // The mapping stays valid without the descriptor.
+    ::close(fd);
+#endif
+}
+
+mapped_file::~mapped_file() {
+    close();
+}
+
+mapped_file& mapped_file::operator=(mapped_file&& other) noexcept {
+    if (this != &other) {
+        close();
+        std::swap(bytes, other.bytes);
+        std::swap(length, other.length);
+        std::swap(open, other.open);
+#if defined(_WIN32)
+        std::swap(file, other.file);
+        std::swap(mapping, other.mapping);
+#endif
+    }
+    return *this;
+}
+
+void mapped_file::close() {
+#if defined(_WIN32)
+    if (bytes)
+        UnmapViewOfFile(bytes);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file)
+        CloseHandle(file);
+    file = nullptr;
+    mapping = nullptr;
+#else
+    if (bytes)
+        munmap(const_cast<char*>(bytes), length);
+#endif
+    bytes = nullptr;
+    length = 0;
+    open = false;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+// A file mapped read-only into memory, for loaders that parse or use the
+// bytes in place instead of reading them into buffers of their own.
+class mapped_file {
+public:
+    mapped_file() {}
+    // Maps the whole file at path; is_open() tells whether that worked.
+    explicit mapped_file(const char* path);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file(mapped_file&& other) noexcept { *this = std::move(other); }
+    mapped_file& operator=(mapped_file&& other) noexcept;
+
+    bool is_open() const { return open; }
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+private:
+    void close();
+
+    const char* bytes = nullptr;
+    size_t length = 0;
+    bool open = false;
+#if defined(_WIN32)
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
@@ -4,83 +4,165 @@
 #include "hittable.h"
 #include "color.h"
 
-class material {
-public:
-    virtual bool scatter(
-        const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-    ) const = 0;
-};
+#include <cstdint>
+#include <vector>
+
+// The kinds of material are plain values. material below holds any one of
+// them and dispatches with a switch, so a scene's materials are a single
+// contiguous array and no bounce makes a virtual call.
 
-class lambertian : public material {
+class lambertian {
 public:
     lambertian(const color& a) : albedo(a) {}
 
-    virtual bool scatter(
+    bool scatter(
         const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
     ) const {
         vec3 scatter_direction = rec.normal + vec3::random_unit_vector();
-        scattered = ray(rec.p, scatter_direction);
+        scattered = rec.spawn_ray(scatter_direction);
         attenuation = albedo;
         return true;
     }
 
+    // normal + random_unit_vector is cosine distributed over the hemisphere.
+    bool evaluate(const hit_record& rec, const vec3& dir, color& f_cos, real& pdf) const {
+        auto cosine = fmax(dot(rec.normal, dir), real(0));
+        pdf = cosine / pi;
+        f_cos = albedo * pdf;
+        return true;
+    }
+
 public:
     color albedo;
 };
 
-class metal : public material {
+class metal {
 public:
-    metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+    metal(const color& a, real f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
-    virtual bool scatter(
+    bool scatter(
         const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
     ) const {
         vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-        scattered = ray(rec.p, reflected + fuzz * vec3::random_in_unit_sphere());
+        scattered = rec.spawn_ray(reflected + fuzz * vec3::random_in_unit_sphere());
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
     }
 
 public:
     color albedo;
-    double fuzz;
+    real fuzz;
 };
 
-double schlick(double cosine, double ref_idx) {
+inline real schlick(real cosine, real ref_idx) {
     auto r0 = (1 - ref_idx) / (1 + ref_idx);
     r0 = r0 * r0;
     return r0 + (1 - r0) * pow((1 - cosine), 5);
 }
 
-class dielectric : public material {
+class dielectric {
 public:
-    dielectric(double ri) : ref_idx(ri) {}
+    dielectric(real ri) : ref_idx(ri) {}
 
-    virtual bool scatter(
+    bool scatter(
         const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
     ) const {
         attenuation = color(1.0, 1.0, 1.0);
-        double etai_over_etat = (rec.front_face) ? (1.0 / ref_idx) : (ref_idx);
+        real etai_over_etat = (rec.front_face) ? (1 / ref_idx) : (ref_idx);
 
         vec3 unit_direction = unit_vector(r_in.direction());
-        double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-        double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
-        if (etai_over_etat * sin_theta > 1.0) {
+        real cos_theta = fmin(dot(-unit_direction, rec.normal), real(1));
+        real sin_theta = sqrt(1 - cos_theta * cos_theta);
+        if (etai_over_etat * sin_theta > 1) {
             vec3 reflected = reflect(unit_direction, rec.normal);
-            scattered = ray(rec.p, reflected);
+            scattered = rec.spawn_ray(reflected);
             return true;
         }
-        double reflect_prob = schlick(cos_theta, etai_over_etat);
+        real reflect_prob = schlick(cos_theta, etai_over_etat);
         if (random_double() < reflect_prob)
         {
             vec3 reflected = reflect(unit_direction, rec.normal);
-            scattered = ray(rec.p, reflected);
+            scattered = rec.spawn_ray(reflected);
             return true;
         }
         vec3 refracted = refract(unit_direction, rec.normal, etai_over_etat);
-        scattered = ray(rec.p, refracted);
+        scattered = rec.spawn_ray(refracted);
         return true;
     }
 
-    double ref_idx;
+    real ref_idx;
+};
+
+class diffuse_light {
+public:
+    diffuse_light(const color& c) : emit(c) {}
+
+    // Emits from the outside of the surface only.
+    color emitted(const hit_record& rec) const {
+        return rec.front_face ? emit : color(0, 0, 0);
+    }
+
+public:
+    color emit;
+};
+
+class material {
+public:
+    // count is the number of kinds, not a kind of its own.
+    enum class kind : uint32_t { lambertian, metal, dielectric, diffuse_light, count };
+
+    material(const lambertian& m) : type(kind::lambertian), as_lambertian(m) {}
+    material(const metal& m) : type(kind::metal), as_metal(m) {}
+    material(const dielectric& m) : type(kind::dielectric), as_dielectric(m) {}
+    material(const diffuse_light& m) : type(kind::diffuse_light), as_diffuse_light(m) {}
+
+    // Returns false if the ray is absorbed.
+    bool scatter(
+        const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+    ) const {
+        switch (type) {
+        case kind::lambertian: return as_lambertian.scatter(r_in, rec, attenuation, scattered);
+        case kind::metal: return as_metal.scatter(r_in, rec, attenuation, scattered);
+        case kind::dielectric: return as_dielectric.scatter(r_in, rec, attenuation, scattered);
+        default: return false;
+        }
+    }
+
+    // Light given off at the hit point; black for everything but lights.
+    color emitted(const hit_record& rec) const {
+        return type == kind::diffuse_light ? as_diffuse_light.emitted(rec) : color(0, 0, 0);
+    }
+
+    // For materials that scatter diffusely: reflectance times cosine towards
+    // the unit vector dir, and the density (per solid angle) with which
+    // scatter() picks dir. Specular materials return false and are only
+    // lit through the rays scatter() sends out.
+    bool evaluate(const hit_record& rec, const vec3& dir, color& f_cos, real& pdf) const {
+        return type == kind::lambertian && as_lambertian.evaluate(rec, dir, f_cos, pdf);
+    }
+
+public:
+    kind type;
+    union {
+        lambertian as_lambertian;
+        metal as_metal;
+        dielectric as_dielectric;
+        diffuse_light as_diffuse_light;
+    };
+};
+
+// Scene-owned material storage. Primitives and hit records refer to entries
+// by index into one array of materials stored by value.
+class material_table {
+public:
+    uint32_t add(const material& m) {
+        materials.push_back(m);
+        return static_cast<uint32_t>(materials.size() - 1);
+    }
+
+    const material& operator[](uint32_t id) const { return materials[id]; }
+    size_t size() const { return materials.size(); }
+
+public:
+    std::vector<material> materials;
 };
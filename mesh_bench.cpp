@@ -0,0 +1,83 @@
+// Benchmark of triangle_mesh on a procedural torus of a million triangles:
+// the BVH build with both methods, then closest-hit and any-hit queries for
+// coherent camera rays and for incoherent rays across the mesh.
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "rtweekend.h"
+#include "scene.h"
+#include "triangle_mesh.h"
+
+namespace {
+
+const int rings = 1000;
+const int sides = 500;
+const int ray_count = 1 << 20;
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Traces rays with hit() and then occluded() and prints the rates.
+void trace(const char* name, const triangle_mesh& mesh, const std::vector<ray>& rays) {
+    auto start = std::chrono::steady_clock::now();
+    size_t hits = 0;
+    hit_record rec;
+    for (const auto& r : rays)
+        hits += mesh.hit(r, epsilon, infinity, rec);
+    auto hit_seconds = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    size_t blocked = 0;
+    for (const auto& r : rays)
+        blocked += mesh.occluded(r, epsilon, infinity);
+    auto occluded_seconds = seconds_since(start);
+
+    printf("%-10s hit %6.2f Mrays/s, occluded %6.2f Mrays/s, %.1f%% hit%s\n", name,
+        rays.size() / hit_seconds * 1e-6, rays.size() / occluded_seconds * 1e-6,
+        100.0 * hits / rays.size(), hits == blocked ? "" : " (occluded disagrees)");
+}
+
+}
+
+int main()
+{
+    thread_rng() = pcg32();
+    const point3 center(0, 0, 0);
+    shared_ptr<triangle_mesh> mesh;
+    for (auto method : { bvh_build::lbvh, bvh_build::sah }) {
+        auto start = std::chrono::steady_clock::now();
+        mesh = make_torus(center, 1.6, 0.6, rings, sides, 0, method);
+        printf("%-4s build (tessellation included) %.0f ms\n", method == bvh_build::sah ? "sah" : "lbvh", 1000 * seconds_since(start));
+    }
+    auto bytes = mesh->positions.size() * sizeof(float) + mesh->normals.size() * sizeof(float)
+        + mesh->indices.size() * sizeof(uint32_t) + mesh->tree.nodes.size() * sizeof(mesh->tree.nodes[0]);
+    printf("%zu triangles, %zu vertices, %.1f MB with normals and BVH\n", mesh->size(), mesh->vertex_count(), bytes / 1e6);
+
+    // A pinhole camera looking down at the torus from above and to the side.
+    std::vector<ray> camera_rays;
+    int side = 1024;
+    point3 eye(0, 3, 5);
+    vec3 forward = unit_vector(center - eye);
+    vec3 right = unit_vector(cross(forward, vec3(0, 1, 0)));
+    vec3 up = cross(right, forward);
+    for (int j = 0; j < side; ++j) {
+        for (int i = 0; i < side; ++i) {
+            auto u = (i + 0.5) / side - 0.5, v = (j + 0.5) / side - 0.5;
+            camera_rays.push_back(ray(eye, forward + 0.9 * u * right + 0.9 * v * up));
+        }
+    }
+    trace("camera", *mesh, camera_rays);
+
+    // From random points around the torus to random points in its bounds.
+    std::vector<ray> random_rays;
+    for (int k = 0; k < ray_count; ++k) {
+        auto from = 4 * vec3::random_unit_vector();
+        auto to = point3(random_double(-2.2, 2.2), random_double(-0.7, 0.7), random_double(-2.2, 2.2));
+        random_rays.push_back(ray(from, to - from));
+    }
+    trace("random", *mesh, random_rays);
+    return 0;
+}
@@ -0,0 +1,363 @@
+#include "obj_loader.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <omp.h>
+
+namespace {
+
+// Chunks are never cut smaller than this, so small files are not split up
+// for nothing; larger ones get several chunks per thread.
+const size_t min_chunk_size = 1 << 20;
+
+// Powers of ten a double holds exactly.
+const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+inline const char* skip_space(const char* p, const char* end) {
+    while (p < end && is_space(*p))
+        ++p;
+    return p;
+}
+
+// The '\n' ending the line that p is on, or end.
+inline const char* line_end(const char* p, const char* end) {
+    auto newline = static_cast<const char*>(memchr(p, '\n', end - p));
+    return newline ? newline : end;
+}
+
+// Parses a decimal number such as -1.25e-3 at p and moves p past it. Unlike
+// strtod it needs no terminating zero and consults no locale. Up to 19
+// significant digits are gathered into an integer and scaled by a power of
+// ten, which is within a few ulps of a double and so exact enough for the
+// float it is rounded to.
+bool parse_float(const char*& p, const char* end, float& value) {
+    auto s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+'))
+        negative = *s++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0;     // significant digits in mantissa
+    int exponent = 0;
+    bool any = false;
+    for (; s < end && is_digit(*s); ++s, any = true) {
+        if (digits < 19) {
+            mantissa = 10 * mantissa + (*s - '0');
+            digits += mantissa != 0;
+        } else {
+            ++exponent;
+        }
+    }
+    if (s < end && *s == '.') {
+        for (++s; s < end && is_digit(*s); ++s, any = true) {
+            if (digits < 19) {
+                mantissa = 10 * mantissa + (*s - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+    if (!any)
+        return false;
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        auto e = s + 1;
+        bool negative_exponent = false;
+        if (e < end && (*e == '-' || *e == '+'))
+            negative_exponent = *e++ == '-';
+        if (e < end && is_digit(*e)) {
+            int n = 0;
+            for (; e < end && is_digit(*e); ++e)
+                n = std::min(10 * n + (*e - '0'), 100000);
+            exponent += negative_exponent ? -n : n;
+            s = e;
+        }
+    }
+
+    double x = static_cast<double>(mantissa);
+    if (exponent < -22)
+        x /= std::pow(10.0, -exponent);
+    else if (exponent < 0)
+        x /= exact_powers_of_ten[-exponent];
+    else if (exponent > 22)
+        x *= std::pow(10.0, exponent);
+    else if (exponent > 0)
+        x *= exact_powers_of_ten[exponent];
+    value = static_cast<float>(negative ? -x : x);
+    p = s;
+    return true;
+}
+
+// Parses a decimal integer at p and moves p past it.
+bool parse_int(const char*& p, const char* end, int64_t& value) {
+    auto s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+'))
+        negative = *s++ == '-';
+    if (s == end || !is_digit(*s))
+        return false;
+    int64_t n = 0;
+    for (; s < end && is_digit(*s); ++s)
+        n = std::min<int64_t>(10 * n + (*s - '0'), std::numeric_limits<uint32_t>::max());
+    value = negative ? -n : n;
+    p = s;
+    return true;
+}
+
+enum class line_kind {
+    vertex,     // v x y z
+    normal,     // vn x y z
+    face,       // f v1[/vt1[/vn1]] v2... with three or more vertices
+    other
+};
+
+// What the line at p holds, moving p past the keyword.
+line_kind classify(const char*& p, const char* end) {
+    auto n = end - p;
+    if (n >= 2 && p[0] == 'v' && is_space(p[1])) {
+        p += 2;
+        return line_kind::vertex;
+    }
+    if (n >= 3 && p[0] == 'v' && p[1] == 'n' && is_space(p[2])) {
+        p += 3;
+        return line_kind::normal;
+    }
+    if (n >= 2 && p[0] == 'f' && is_space(p[1])) {
+        p += 2;
+        return line_kind::face;
+    }
+    return line_kind::other;
+}
+
+// A piece of the file ending at a line end. The first pass counts what it
+// holds; the counts of the chunks before it then place it in the buffers.
+struct obj_chunk {
+    const char* begin;
+    const char* end;
+    size_t lines = 0;
+    size_t vertices = 0;
+    size_t normals = 0;
+    size_t triangles = 0;
+    size_t first_line = 0;
+    size_t first_vertex = 0;
+    size_t first_normal = 0;
+    size_t first_triangle = 0;
+    bool normals_match = true;      // every face names the normal of its vertex index
+    const char* error = nullptr;    // the first error in the chunk, if any
+    size_t error_line = 0;
+};
+
+void count_chunk(obj_chunk& c) {
+    for (auto p = c.begin; p < c.end; ++c.lines) {
+        auto e = line_end(p, c.end);
+        auto q = skip_space(p, e);
+        switch (classify(q, e)) {
+        case line_kind::vertex:
+            ++c.vertices;
+            break;
+        case line_kind::normal:
+            ++c.normals;
+            break;
+        case line_kind::face: {
+            size_t refs = 0;
+            for (q = skip_space(q, e); q < e; q = skip_space(q, e)) {
+                ++refs;
+                while (q < e && !is_space(*q))
+                    ++q;
+            }
+            if (refs >= 3)
+                c.triangles += refs - 2;
+            break;
+        }
+        default:
+            break;
+        }
+        p = e + 1;
+    }
+}
+
+// The zero-based index that OBJ index i names: counted from 1, or back from
+// the last of the defined elements if negative. -1 if out of range.
+int64_t resolve(int64_t i, size_t defined, size_t total) {
+    auto index = i > 0 ? i - 1 : static_cast<int64_t>(defined) + i;
+    return i != 0 && index >= 0 && index < static_cast<int64_t>(total) ? index : -1;
+}
+
+// The second pass: parses the lines of c into the mesh buffers at the
+// chunk's offsets.
+void parse_chunk(obj_chunk& c, size_t total_vertices, size_t total_normals, float* positions, float* normals, uint32_t* indices) {
+    auto vertex = c.first_vertex;
+    auto normal = c.first_normal;
+    auto triangle = c.first_triangle;
+    auto line = c.first_line;
+    auto parse_vec3 = [&](const char*& q, const char* e, float* out) {
+        for (int k = 0; k < 3; ++k) {
+            q = skip_space(q, e);
+            if (!parse_float(q, e, out[k]))
+                return false;
+        }
+        return true;
+    };
+
+    for (auto p = c.begin; p < c.end; p = line_end(p, c.end) + 1) {
+        ++line;
+        auto e = line_end(p, c.end);
+        auto q = skip_space(p, e);
+        const char* error = nullptr;
+        switch (classify(q, e)) {
+        case line_kind::vertex:
+            if (!parse_vec3(q, e, &positions[3 * vertex++]))
+                error = "expected three vertex coordinates";
+            break;
+        case line_kind::normal:
+            if (!parse_vec3(q, e, &normals[3 * normal++]))
+                error = "expected three normal coordinates";
+            break;
+        case line_kind::face: {
+            uint32_t first = 0, previous = 0;
+            int count = 0;
+            for (q = skip_space(q, e); q < e && !error; q = skip_space(q, e), ++count) {
+                int64_t v, vt, vn;
+                if (!parse_int(q, e, v)) {
+                    error = "expected a vertex index";
+                    break;
+                }
+                v = resolve(v, vertex, total_vertices);
+                bool has_normal = false;
+                if (q < e && *q == '/') {
+                    ++q;
+                    if (q < e && *q != '/' && !parse_int(q, e, vt))
+                        error = "expected a texture coordinate index";
+                    if (q < e && *q == '/') {
+                        ++q;
+                        has_normal = parse_int(q, e, vn);
+                        if (!has_normal)
+                            error = "expected a normal index";
+                        else if (resolve(vn, normal, total_normals) != v)
+                            c.normals_match = false;
+                    }
+                }
+                if (!has_normal)
+                    c.normals_match = false;
+                if (!error && q < e && !is_space(*q))
+                    error = "unexpected character in face";
+                if (!error && v < 0)
+                    error = "vertex index out of range";
+                if (error)
+                    break;
+
+                auto index = static_cast<uint32_t>(v);
+                if (count == 0) {
+                    first = index;
+                } else if (count >= 2) {
+                    auto* out = &indices[3 * triangle++];
+                    out[0] = first;
+                    out[1] = previous;
+                    out[2] = index;
+                }
+                previous = index;
+            }
+            if (!error && count < 3)
+                error = "face with fewer than three vertices";
+            break;
+        }
+        default:
+            break;
+        }
+        if (error) {
+            c.error = error;
+            c.error_line = line;
+            return;
+        }
+    }
+}
+
+}
+
+bool load_obj(const char* path, triangle_mesh& mesh) {
+    mapped_file file(path);
+    if (!file.is_open()) {
+        std::cerr << "cannot open " << path << "\n";
+        return false;
+    }
+
+    // Cut the file just after line ends into chunks of about equal size.
+    std::vector<obj_chunk> chunks;
+    auto end = file.data() + file.size();
+    auto chunk_size = std::max(min_chunk_size, file.size() / (8 * omp_get_max_threads()) + 1);
+    for (auto p = file.data(); p < end;) {
+        auto q = p + std::min(chunk_size, static_cast<size_t>(end - p));
+        if (q < end)
+            q = std::min(line_end(q, end) + 1, end);
+        obj_chunk c;
+        c.begin = p;
+        c.end = q;
+        chunks.push_back(c);
+        p = q;
+    }
+    auto n = static_cast<int64_t>(chunks.size());
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < n; ++i)
+        count_chunk(chunks[i]);
+
+    size_t lines = 0, vertices = 0, normals = 0, triangles = 0;
+    for (auto& c : chunks) {
+        c.first_line = lines;
+        c.first_vertex = vertices;
+        c.first_normal = normals;
+        c.first_triangle = triangles;
+        lines += c.lines;
+        vertices += c.vertices;
+        normals += c.normals;
+        triangles += c.triangles;
+    }
+    if (vertices > std::numeric_limits<uint32_t>::max()) {
+        std::cerr << path << ": too many vertices\n";
+        return false;
+    }
+
+    std::vector<float> normal_buffer(3 * normals);
+    // Back to vertices of its own, should it have used some in place.
+    mesh.use_vertices(nullptr, nullptr, nullptr, 0, 0);
+    mesh.positions.resize(3 * vertices);
+    mesh.indices.resize(3 * triangles);
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < n; ++i)
+        parse_chunk(chunks[i], vertices, normals, mesh.positions.data(), normal_buffer.data(), mesh.indices.data());
+
+    bool normals_match = normals == vertices;
+    for (const auto& c : chunks) {
+        if (c.error) {
+            std::cerr << path << ":" << c.error_line << ": " << c.error << "\n";
+            mesh.positions.clear();
+            mesh.indices.clear();
+            return false;
+        }
+        normals_match = normals_match && c.normals_match;
+    }
+    if (normals_match && triangles > 0)
+        mesh.normals.swap(normal_buffer);
+    else
+        mesh.normals.clear();
+    mesh.tree = linear_wide_bvh<8>();
+    mesh.box = aabb();
+    return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "triangle_mesh.h"
+
+// Reads the triangles of the Wavefront OBJ file at path into mesh, replacing
+// its vertices and indices; the BVH is left to mesh.build(). The file is
+// memory-mapped and cut into chunks at line ends that are parsed in
+// parallel, straight into the flat buffers of the mesh. Polygons become
+// fans of triangles. Vertex normals are kept if every face uses the normal
+// with the same index as its position, which is the only pairing the mesh's
+// single index buffer can hold; otherwise there are none. Texture
+// coordinates, groups and materials are skipped. On failure prints where to
+// std::cerr and returns false.
+bool load_obj(const char* path, triangle_mesh& mesh);
@@ -0,0 +1,398 @@
+#include "ply_loader.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+enum class ply_type { int8, uint8, int16, uint16, int32, uint32, float32, float64, none };
+
+const char* const type_names[] = { "char", "uchar", "short", "ushort", "int", "uint", "float", "double" };
+const char* const sized_type_names[] = { "int8", "uint8", "int16", "uint16", "int32", "uint32", "float32", "float64" };
+const size_t type_sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+ply_type parse_type(const std::string& name) {
+    for (int t = 0; t < 8; ++t) {
+        if (name == type_names[t] || name == sized_type_names[t])
+            return static_cast<ply_type>(t);
+    }
+    return ply_type::none;
+}
+
+size_t size_of(ply_type t) {
+    return type_sizes[static_cast<int>(t)];
+}
+
+bool is_integer(ply_type t) {
+    return t != ply_type::float32 && t != ply_type::float64;
+}
+
+// The value at p, which need not be aligned. PLY data in the format read
+// here is little-endian, like the machines the renderer runs on.
+template <typename T>
+T load(const char* p) {
+    T value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+double read_value(ply_type t, const char* p) {
+    switch (t) {
+    case ply_type::int8: return load<int8_t>(p);
+    case ply_type::uint8: return load<uint8_t>(p);
+    case ply_type::int16: return load<int16_t>(p);
+    case ply_type::uint16: return load<uint16_t>(p);
+    case ply_type::int32: return load<int32_t>(p);
+    case ply_type::uint32: return load<uint32_t>(p);
+    case ply_type::float32: return load<float>(p);
+    default: return load<double>(p);
+    }
+}
+
+int64_t read_integer(ply_type t, const char* p) {
+    switch (t) {
+    case ply_type::int8: return load<int8_t>(p);
+    case ply_type::uint8: return load<uint8_t>(p);
+    case ply_type::int16: return load<int16_t>(p);
+    case ply_type::uint16: return load<uint16_t>(p);
+    case ply_type::int32: return load<int32_t>(p);
+    default: return load<uint32_t>(p);
+    }
+}
+
+struct ply_property {
+    std::string name;
+    ply_type type;                      // of the value, or of the items of a list
+    ply_type count_type = ply_type::none;   // of the length of a list, none if no list
+    size_t offset = 0;                  // from the start of a record without lists
+};
+
+struct ply_element {
+    std::string name;
+    size_t count = 0;
+    std::vector<ply_property> properties;
+    bool fixed = true;          // no lists, so every record is record_size bytes
+    size_t record_size = 0;
+
+    const ply_property* find(const char* property) const {
+        for (const auto& p : properties) {
+            if (p.name == property)
+                return &p;
+        }
+        return nullptr;
+    }
+};
+
+// Reads the header at the start of data into elements and sets data_offset
+// to the first byte after it. On failure sets error.
+bool parse_header(const char* data, size_t size, std::vector<ply_element>& elements, size_t& data_offset, const char*& error) {
+    const char* end = data + size;
+    bool binary = false;
+    for (auto p = data; p < end;) {
+        auto newline = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!newline)
+            break;
+        std::istringstream line(std::string(p, newline));
+        bool first = p == data;
+        p = newline + 1;
+        std::string keyword;
+        line >> keyword;
+        if (first) {
+            if (keyword != "ply")
+                break;
+        } else if (keyword == "format") {
+            std::string format;
+            line >> format;
+            binary = format == "binary_little_endian";
+        } else if (keyword == "element") {
+            ply_element e;
+            line >> e.name >> e.count;
+            if (!line) {
+                error = "malformed element";
+                return false;
+            }
+            elements.push_back(e);
+        } else if (keyword == "property") {
+            if (elements.empty()) {
+                error = "property before any element";
+                return false;
+            }
+            auto& e = elements.back();
+            ply_property property;
+            std::string type;
+            line >> type;
+            if (type == "list") {
+                std::string count_type;
+                line >> count_type >> type;
+                property.count_type = parse_type(count_type);
+                if (property.count_type == ply_type::none || !is_integer(property.count_type)) {
+                    error = "bad list length type";
+                    return false;
+                }
+                e.fixed = false;
+            }
+            property.type = parse_type(type);
+            line >> property.name;
+            if (property.type == ply_type::none || !line) {
+                error = "malformed property";
+                return false;
+            }
+            if (e.fixed) {
+                property.offset = e.record_size;
+                e.record_size += size_of(property.type);
+            }
+            e.properties.push_back(property);
+        } else if (keyword == "end_header") {
+            if (!binary) {
+                error = "only binary_little_endian PLY files are supported";
+                return false;
+            }
+            data_offset = p - data;
+            return true;
+        }
+    }
+    error = "not a PLY file";
+    return false;
+}
+
+// Moves p past one value or list of property; false if that runs past end.
+bool skip_property(const ply_property& property, const char*& p, const char* end) {
+    size_t bytes = size_of(property.type);
+    if (property.count_type != ply_type::none) {
+        if (static_cast<size_t>(end - p) < size_of(property.count_type))
+            return false;
+        auto n = read_integer(property.count_type, p);
+        if (n < 0)
+            return false;
+        p += size_of(property.count_type);
+        bytes *= static_cast<size_t>(n);
+    }
+    if (static_cast<size_t>(end - p) < bytes)
+        return false;
+    p += bytes;
+    return true;
+}
+
+// Moves p past one record of e, which has lists; false if that runs past end.
+bool skip_record(const ply_element& e, const char*& p, const char* end) {
+    for (const auto& property : e.properties) {
+        if (!skip_property(property, p, end))
+            return false;
+    }
+    return true;
+}
+
+// Points the mesh at the positions and normals of the vertex element at
+// begin, or copies them if they cannot be used in place.
+bool read_vertices(const ply_element& e, const char* begin, const shared_ptr<mapped_file>& file, triangle_mesh& mesh, const char*& error) {
+    const ply_property* position[] = { e.find("x"), e.find("y"), e.find("z") };
+    const ply_property* normal[] = { e.find("nx"), e.find("ny"), e.find("nz") };
+    if (!position[0] || !position[1] || !position[2] || !e.fixed) {
+        error = "vertices need x, y and z and no lists";
+        return false;
+    }
+    bool has_normals = normal[0] && normal[1] && normal[2];
+
+    // Three consecutive floats, wherever they lie in the record.
+    auto in_place = [&](const ply_property* const* xyz) {
+        for (int k = 0; k < 3; ++k) {
+            if (xyz[k]->type != ply_type::float32 || xyz[k]->offset != xyz[0]->offset + 4 * k)
+                return false;
+        }
+        return true;
+    };
+    bool positions_in_place = in_place(position);
+    bool normals_in_place = positions_in_place && has_normals && in_place(normal);
+    auto n = static_cast<int64_t>(e.count);
+    auto copy = [&](const ply_property* const* xyz, std::vector<float>& out) {
+        out.resize(3 * e.count);
+        #pragma omp parallel for
+        for (int64_t i = 0; i < n; ++i) {
+            const char* record = begin + e.record_size * i;
+            for (int k = 0; k < 3; ++k)
+                out[3 * i + k] = static_cast<float>(read_value(xyz[k]->type, record + xyz[k]->offset));
+        }
+    };
+
+    if (positions_in_place) {
+        mesh.use_vertices(file, begin + position[0]->offset,
+            normals_in_place ? begin + normal[0]->offset : nullptr, e.count, e.record_size);
+    } else {
+        mesh.use_vertices(nullptr, nullptr, nullptr, 0, 0);
+        copy(position, mesh.positions);
+    }
+    if (has_normals && !normals_in_place)
+        copy(normal, mesh.normals);
+    return true;
+}
+
+// Reads the faces at begin into the index buffer and sets end to the byte
+// after them.
+bool read_faces(const ply_element& e, const char* begin, const char*& end, size_t vertices, triangle_mesh& mesh, const char*& error) {
+    const ply_property* list = e.find("vertex_indices");
+    if (!list)
+        list = e.find("vertex_index");
+    if (!list || list->count_type == ply_type::none || !is_integer(list->type)) {
+        error = "faces need a list of vertex indices";
+        return false;
+    }
+    auto n = static_cast<int64_t>(e.count);
+    auto& indices = mesh.indices;
+
+    // The common layout of triangles only: a count of 3 in one byte and
+    // three 4-byte indices, 13 bytes to a face, found in parallel.
+    const size_t triangle_size = 13;
+    if (e.properties.size() == 1 && size_of(list->count_type) == 1 && size_of(list->type) == 4
+        && static_cast<size_t>(end - begin) / triangle_size >= e.count) {
+        indices.resize(3 * e.count);
+        int64_t others = 0, out_of_range = 0;
+        #pragma omp parallel for reduction(+:others, out_of_range)
+        for (int64_t i = 0; i < n; ++i) {
+            const char* face = begin + triangle_size * i;
+            if (load<uint8_t>(face) != 3) {
+                ++others;
+                continue;
+            }
+            for (int k = 0; k < 3; ++k) {
+                auto v = read_integer(list->type, face + 1 + 4 * k);
+                out_of_range += v < 0 || static_cast<size_t>(v) >= vertices;
+                indices[3 * i + k] = static_cast<uint32_t>(v);
+            }
+        }
+        if (others == 0) {
+            if (out_of_range > 0) {
+                error = "vertex index out of range";
+                return false;
+            }
+            end = begin + triangle_size * e.count;
+            return true;
+        }
+    }
+
+    // Any other layout, face by face.
+    indices.clear();
+    auto p = begin;
+    for (int64_t i = 0; i < n; ++i) {
+        for (const auto& property : e.properties) {
+            if (&property != list) {
+                if (!skip_property(property, p, end)) {
+                    error = "faces run past the end of the file";
+                    return false;
+                }
+                continue;
+            }
+            auto count_size = size_of(list->count_type), index_size = size_of(list->type);
+            if (static_cast<size_t>(end - p) < count_size) {
+                error = "faces run past the end of the file";
+                return false;
+            }
+            auto count = read_integer(list->count_type, p);
+            p += count_size;
+            if (count < 3) {
+                error = "face with fewer than three vertices";
+                return false;
+            }
+            if (static_cast<size_t>(end - p) / index_size < static_cast<size_t>(count)) {
+                error = "faces run past the end of the file";
+                return false;
+            }
+            int64_t first = 0, previous = 0;
+            for (int64_t k = 0; k < count; ++k, p += index_size) {
+                auto v = read_integer(list->type, p);
+                if (v < 0 || static_cast<size_t>(v) >= vertices) {
+                    error = "vertex index out of range";
+                    return false;
+                }
+                if (k == 0) {
+                    first = v;
+                } else if (k >= 2) {
+                    indices.push_back(static_cast<uint32_t>(first));
+                    indices.push_back(static_cast<uint32_t>(previous));
+                    indices.push_back(static_cast<uint32_t>(v));
+                }
+                previous = v;
+            }
+        }
+    }
+    end = p;
+    return true;
+}
+
+}
+
+bool load_ply(const char* path, triangle_mesh& mesh) {
+    auto file = make_shared<mapped_file>(path);
+    if (!file->is_open()) {
+        std::cerr << "cannot open " << path << "\n";
+        return false;
+    }
+
+    std::vector<ply_element> elements;
+    size_t offset = 0;
+    const char* error = nullptr;
+    if (!parse_header(file->data(), file->size(), elements, offset, error)) {
+        std::cerr << path << ": " << error << "\n";
+        return false;
+    }
+    const ply_element* vertex_element = nullptr;
+    const ply_element* face_element = nullptr;
+    for (const auto& e : elements) {
+        if (e.name == "vertex")
+            vertex_element = &e;
+        else if (e.name == "face")
+            face_element = &e;
+    }
+    if (!vertex_element || !face_element) {
+        std::cerr << path << ": no vertex or no face element\n";
+        return false;
+    }
+    if (vertex_element->count > std::numeric_limits<uint32_t>::max()) {
+        std::cerr << path << ": too many vertices\n";
+        return false;
+    }
+
+    // The elements follow each other in the order of the header.
+    const char* data = file->data() + offset;
+    const char* end = file->data() + file->size();
+    mesh.indices.clear();
+    for (const auto& e : elements) {
+        if (e.fixed && static_cast<size_t>(end - data) / std::max<size_t>(e.record_size, 1) < e.count) {
+            error = "file ends early";
+        } else if (&e == vertex_element) {
+            if (read_vertices(e, data, file, mesh, error))
+                data += e.record_size * e.count;
+        } else if (&e == face_element) {
+            auto face_end = end;
+            if (read_faces(e, data, face_end, vertex_element->count, mesh, error))
+                data = face_end;
+        } else if (e.fixed) {
+            data += e.record_size * e.count;
+        } else {
+            for (size_t i = 0; i < e.count && !error; ++i) {
+                if (!skip_record(e, data, end))
+                    error = "file ends early";
+            }
+        }
+        if (error)
+            break;
+        // Nothing after the faces is needed.
+        if (&e == face_element && vertex_element < face_element)
+            break;
+    }
+    if (error) {
+        std::cerr << path << ": " << error << "\n";
+        mesh.use_vertices(nullptr, nullptr, nullptr, 0, 0);
+        mesh.indices.clear();
+        return false;
+    }
+    mesh.tree = linear_wide_bvh<8>();
+    mesh.box = aabb();
+    return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "triangle_mesh.h"
+
+// Reads the triangles of the binary little-endian PLY file at path into
+// mesh, replacing its vertices and indices; the BVH is left to mesh.build().
+// The file is memory-mapped, and if the vertex element stores x, y, z (and
+// nx, ny, nz, if present) as consecutive floats, the mesh uses them in place
+// and keeps the mapping open for as long as it needs them. Other layouts are
+// converted into the mesh's own buffers. Face lists become fans of
+// triangles; when every face is a triangle listed with a one-byte count and
+// 4-byte indices, they are read in parallel. Other elements and properties
+// are skipped. On failure prints why to std::cerr and returns false.
+bool load_ply(const char* path, triangle_mesh& mesh);
@@ -0,0 +1,318 @@
+#include "render.h"
+#include "wavefront.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+color background(const ray& r, const render_settings& settings) {
+    if (!settings.sky)
+        return color(0, 0, 0);
+    vec3 unit_direction = unit_vector(r.direction());
+    auto t = 0.5 * (unit_direction.y() + 1.0);
+    return (1.0 - t) * color(1.0, 1.0, 1.0) + t * color(0.5, 0.7, 1.0);
+}
+
+bool is_black(const color& c) {
+    return c.x() <= 0 && c.y() <= 0 && c.z() <= 0;
+}
+
+// Relative distance short of a sampled light where its shadow ray stops.
+const real shadow_margin = 1e-6;
+
+// Power heuristic weight for a sample drawn with density pdf, against one
+// other strategy with density other_pdf.
+real power_heuristic(real pdf, real other_pdf) {
+    return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
+}
+
+// Most samples a tile hands to trace_wavefront at once.
+const int wavefront_round = 1 << 16;
+
+}
+
+path_state start_path(const ray& r) {
+    return path_state{ r, color(1, 1, 1), color(0, 0, 0), 0, 0 };
+}
+
+void miss(path_state& p, const render_settings& settings) {
+    p.radiance += p.throughput * background(p.path, settings);
+}
+
+bool shade(path_state& p, const hit_record& rec, const material_table& materials, const light_list& lights, const render_settings& settings,
+    shadow_query& shadow, bool& has_shadow, path_counts& counts)
+{
+    bool sample_lights = settings.light_sampling && !lights.empty();
+    const material& m = materials[rec.mat_id];
+    has_shadow = false;
+
+    color emitted = m.emitted(rec);
+    if (!is_black(emitted)) {
+        // The light sample of the last bounce may have found this light
+        // too; the two estimates are balanced by multiple importance sampling.
+        real weight = 1;
+        if (sample_lights && p.scatter_pdf > 0) {
+            auto light = lights.find(rec);
+            if (light < lights.size())
+                weight = power_heuristic(p.scatter_pdf, lights.pdf(p.path.origin(), unit_vector(p.path.direction()), light));
+        }
+        p.radiance += weight * p.throughput * emitted;
+    }
+
+    // Next-event estimation: a shadow ray towards a sampled light.
+    vec3 light_dir;
+    size_t light;
+    color f_cos;
+    real pdf;
+    if (sample_lights && lights.sample(rec.p, light_dir, light)
+        && m.evaluate(rec, light_dir, f_cos, pdf) && pdf > 0) {
+        ++counts.rays;
+        // Stop just short of the light, so it does not shadow itself.
+        auto light_pdf = lights.pdf(rec.p, light_dir, light);
+        if (light_pdf > 0) {
+            shadow.r = rec.spawn_ray(light_dir);
+            shadow.t_max = lights.distance(shadow.r, light) * (1 - shadow_margin);
+            shadow.contribution = (power_heuristic(light_pdf, pdf) / light_pdf) * p.throughput * f_cos * lights.emit[light];
+            has_shadow = true;
+        }
+    }
+
+    ray scattered;
+    color attenuation;
+    if (!m.scatter(p.path, rec, attenuation, scattered))
+        return false;
+    p.scatter_pdf = 0;
+    if (sample_lights)
+        m.evaluate(rec, unit_vector(scattered.direction()), f_cos, p.scatter_pdf);
+    p.throughput = p.throughput * attenuation;
+    p.path = scattered;
+
+    // Russian roulette, weighted so the estimate stays unbiased. Paths
+    // that still carry full throughput are ended with 5% chance too, so
+    // a ray trapped in glass does not always run to the depth limit.
+    if (++p.bounce >= settings.roulette_depth) {
+        auto survive = std::min(std::max(p.throughput.x(), std::max(p.throughput.y(), p.throughput.z())), real(0.95));
+        if (random_double() >= survive)
+            return false;
+        p.throughput = p.throughput / survive;
+    }
+    // Past the ray bounce limit no more light is gathered.
+    if (p.bounce >= settings.max_depth)
+        return false;
+    ++counts.bounces;
+    return true;
+}
+
+color ray_color(const ray& r, const hittable& world, const material_table& materials, const light_list& lights, const render_settings& settings, path_counts& counts) {
+    hit_record rec;
+    bool hit = world.hit(r, epsilon, infinity, rec);
+    return ray_color(r, hit, rec, world, materials, lights, settings, counts);
+}
+
+color ray_color(const ray& r, bool hit, const hit_record& first, const hittable& world, const material_table& materials, const light_list& lights, const render_settings& settings, path_counts& counts) {
+    // Walks the path one bounce at a time, carrying the product of the
+    // attenuations so far instead of recursing once per bounce.
+    auto p = start_path(r);
+    hit_record rec = first;
+    while (p.bounce < settings.max_depth) {
+        ++counts.rays;
+        if (p.bounce > 0)
+            hit = world.hit(p.path, epsilon, infinity, rec);
+        if (!hit) {
+            miss(p, settings);
+            break;
+        }
+        shadow_query shadow;
+        bool has_shadow;
+        bool alive = shade(p, rec, materials, lights, settings, shadow, has_shadow, counts);
+        if (has_shadow && !world.occluded(shadow.r, epsilon, shadow.t_max))
+            p.radiance += shadow.contribution;
+        if (!alive)
+            break;
+    }
+    return p.radiance;
+}
+
+ray camera_ray(const camera& cam, const render_settings& settings, int i, int j, int sample) {
+    seed_random(uint64_t(j) * settings.image_width + i, sample, 0);
+    auto u = (i + random_double()) / (settings.image_width - 1);
+    auto v = (settings.image_height - 1 - j + random_double()) / (settings.image_height - 1);
+    return cam.get_ray(u, v);
+}
+
+void add_sample(pixel_state& p, const color& c) {
+    auto luminance = static_cast<float>(0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z());
+    p.sum += c;
+    ++p.samples;
+    auto delta = luminance - p.mean;
+    p.mean += delta / p.samples;
+    p.m2 += delta * (luminance - p.mean);
+}
+
+// The standard error of the luminance mean, measured after the gamma 2
+// written by write_color, i.e. scaled by d sqrt(L) / dL.
+bool converged(const pixel_state& p, double threshold) {
+    if (p.samples < min_adaptive_samples)
+        return false;
+    auto standard_error = sqrt(double(p.m2) / (p.samples - 1) / p.samples);
+    return standard_error / (2 * std::max(sqrt(double(p.mean)), 0.05)) < threshold;
+}
+
+void write_pixel(unsigned char* out, const pixel_state& p, const render_settings& settings) {
+    if (settings.heatmap) {
+        // Blue for few samples through green to red for samples_per_pixel.
+        auto t = clamp(double(p.samples) / settings.samples_per_pixel, 0.0, 1.0);
+        write_color(out, color(
+            clamp(1.5 - fabs(4 * t - 3), 0.0, 0.999),
+            clamp(1.5 - fabs(4 * t - 2), 0.0, 0.999),
+            clamp(1.5 - fabs(4 * t - 1), 0.0, 0.999)));
+    } else if (p.samples > 0) {
+        write_color(out, p.sum, p.samples);
+    }
+}
+
+void render(const hittable& world, const material_table& materials, const light_list& lights, const camera& cam, const render_settings& settings,
+    unsigned char* image_data, pixel_state* pixels, render_counters& counters, float* utilization, const std::atomic<bool>& cancel)
+{
+    auto image_width = settings.image_width;
+    auto image_height = settings.image_height;
+    tile_scheduler scheduler(image_width, image_height, settings.tile_size, settings.order);
+    std::vector<double> busy_seconds(settings.threads, 0.0);
+    double wall_seconds = 0;
+
+    auto needs_sample = [&](const pixel_state& p, int last) {
+        return p.samples < last && !(settings.adaptive && converged(p, settings.threshold));
+    };
+    // Brings each pixel of the image up to last samples, or fewer once it
+    // has converged. Returns the number of samples taken.
+    auto render_samples = [&](int last, const std::atomic<bool>& stop) {
+        std::atomic<int64_t> taken(0);
+        scheduler.run(settings.threads, [&](const tile& t) {
+            int64_t tile_taken = 0;
+            path_counts tile_counts;
+            if (settings.wavefront) {
+                // Rounds of samples for the whole tile. Adaptive sampling
+                // has to look at a pixel after each sample, so then a round
+                // takes one per pixel; otherwise as many as fit. Samples are
+                // added in the order a pixel would take them one by one.
+                int tile_pixels = (t.x1 - t.x0) * (t.y1 - t.y0);
+                int per_round = settings.adaptive ? 1 : std::max(1, wavefront_round / tile_pixels);
+                std::vector<sample_request> requests;
+                std::vector<color> results;
+                while (true) {
+                    requests.clear();
+                    for (int j = t.y0; j < t.y1; ++j) {
+                        for (int i = t.x0; i < t.x1; ++i) {
+                            auto& p = pixels[j * image_width + i];
+                            if (!needs_sample(p, last))
+                                continue;
+                            int end = std::min(last, p.samples + per_round);
+                            for (int s = p.samples; s < end; ++s)
+                                requests.push_back(sample_request{ i, j, s });
+                        }
+                    }
+                    if (requests.empty())
+                        break;
+                    results.resize(requests.size());
+                    trace_wavefront(requests.data(), requests.size(), world, materials, lights, cam, settings, results.data(), tile_counts);
+                    for (size_t k = 0; k < requests.size(); ++k)
+                        add_sample(pixels[requests[k].j * image_width + requests[k].i], results[k]);
+                    tile_taken += requests.size();
+                }
+                for (int j = t.y0; j < t.y1; ++j) {
+                    for (int i = t.x0; i < t.x1; ++i)
+                        write_pixel(&image_data[3 * (j * image_width + i)], pixels[j * image_width + i], settings);
+                }
+            } else if (settings.packet_size <= 1) {
+                for (int j = t.y0; j < t.y1; ++j) {
+                    for (int i = t.x0; i < t.x1; ++i) {
+                        auto& p = pixels[j * image_width + i];
+                        while (needs_sample(p, last)) {
+                            ray r = camera_ray(cam, settings, i, j, p.samples);
+                            add_sample(p, ray_color(r, world, materials, lights, settings, tile_counts));
+                            ++tile_taken;
+                        }
+                        write_pixel(&image_data[3 * (j * image_width + i)], p, settings);
+                    }
+                }
+            } else {
+                // Blocks of 2x2, 4x2 or 4x4 pixels. Every round traces the
+                // next camera ray of each pixel in the block that still
+                // wants one as a packet, then follows the paths one by one.
+                // Each path continues the random stream its camera ray was
+                // drawn from, so the image is the same as without packets.
+                int block_w = settings.packet_size >= 8 ? 4 : 2;
+                int block_h = std::min(settings.packet_size, max_packet_size) / block_w;
+                for (int by = t.y0; by < t.y1; by += block_h) {
+                    for (int bx = t.x0; bx < t.x1; bx += block_w) {
+                        int y1 = std::min(by + block_h, t.y1), x1 = std::min(bx + block_w, t.x1);
+                        while (true) {
+                            ray rays[max_packet_size];
+                            pcg32 streams[max_packet_size];
+                            pixel_state* owners[max_packet_size];
+                            int count = 0;
+                            for (int j = by; j < y1; ++j) {
+                                for (int i = bx; i < x1; ++i) {
+                                    auto& p = pixels[j * image_width + i];
+                                    if (!needs_sample(p, last))
+                                        continue;
+                                    rays[count] = camera_ray(cam, settings, i, j, p.samples);
+                                    streams[count] = thread_rng();
+                                    owners[count++] = &p;
+                                }
+                            }
+                            if (count == 0)
+                                break;
+
+                            hit_record recs[max_packet_size];
+                            bool hits[max_packet_size];
+                            world.hit_packet(rays, count, epsilon, infinity, recs, hits);
+                            for (int k = 0; k < count; ++k) {
+                                thread_rng() = streams[k];
+                                add_sample(*owners[k], ray_color(rays[k], hits[k], recs[k], world, materials, lights, settings, tile_counts));
+                            }
+                            tile_taken += count;
+                        }
+                        for (int j = by; j < y1; ++j) {
+                            for (int i = bx; i < x1; ++i)
+                                write_pixel(&image_data[3 * (j * image_width + i)], pixels[j * image_width + i], settings);
+                        }
+                    }
+                }
+            }
+            taken += tile_taken;
+            counters.samples += tile_taken;
+            counters.rays += tile_counts.rays;
+            counters.bounces += tile_counts.bounces;
+        }, stop);
+        for (int t = 0; t < settings.threads; ++t)
+            busy_seconds[t] += scheduler.busy_seconds[t];
+        wall_seconds += scheduler.wall_seconds;
+        return taken.load();
+    };
+
+    if (settings.progressive) {
+        // A pass always runs to the end, so the buffer stays one uniform
+        // sample count and stopping loses nothing. Once every pixel has
+        // converged a pass takes no samples and the render is done.
+        const std::atomic<bool> never{ false };
+        while (!cancel && counters.passes < settings.samples_per_pixel) {
+            auto taken = render_samples(counters.passes + 1, never);
+            ++counters.passes;
+            if (taken == 0 && settings.adaptive)
+                counters.passes = settings.samples_per_pixel;
+        }
+    } else {
+        // Every pixel knows its own sample count, so even a stopped render
+        // can be continued.
+        render_samples(settings.samples_per_pixel, cancel);
+        if (!cancel)
+            counters.passes = settings.samples_per_pixel;
+    }
+
+    if (utilization) {
+        for (int t = 0; t < settings.threads; ++t)
+            utilization[t] = static_cast<float>(busy_seconds[t] / wall_seconds);
+    }
+}
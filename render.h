@@ -0,0 +1,119 @@
+#pragma once
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "camera.h"
+#include "color.h"
+#include "material.h"
+#include "light.h"
+#include "tile_scheduler.h"
+
+#include <atomic>
+#include <cstdint>
+
+struct render_settings {
+    int image_width;
+    int image_height;
+    int samples_per_pixel;
+    int max_depth;
+    int roulette_depth; // bounces before Russian roulette may end a path
+    bool sky;           // sky gradient behind the scene, else black
+    bool light_sampling; // next-event estimation towards the scene's lights
+    int threads;
+    int tile_size;
+    tile_order order;
+    bool progressive;   // one sample per pixel per pass over the whole image
+    bool adaptive;      // stop sampling pixels whose error is below threshold
+    double threshold;
+    bool heatmap;       // show samples taken per pixel instead of the image
+    int packet_size;    // camera rays of neighbouring pixels traced together: 1, 4, 8 or 16
+    bool wavefront;     // trace a tile's samples stage by stage, see trace_wavefront
+};
+
+// Everything accumulated for one pixel, kept between renders so a stopped or
+// finished render can be continued. Besides the color sum it keeps the
+// running mean and squared deviations (Welford) of the sample luminance.
+struct pixel_state {
+    color sum;
+    int samples;
+    float mean;
+    float m2;
+};
+
+// Progress of a render, safe to read while it runs.
+struct render_counters {
+    std::atomic<int> passes{ 0 };       // finished passes of a progressive render
+    std::atomic<int64_t> samples{ 0 };  // camera samples taken
+    std::atomic<int64_t> rays{ 0 };     // rays traced, camera and scattered ones
+    std::atomic<int64_t> bounces{ 0 };  // scatterings that paths went on from
+
+    void reset() { passes = 0; samples = 0; rays = 0; bounces = 0; }
+};
+
+// Adaptive sampling never trusts a variance estimate from fewer samples.
+const int min_adaptive_samples = 16;
+
+// A path between two bounces.
+struct path_state {
+    ray path;           // the ray it follows next
+    color throughput;   // product of the attenuations so far
+    color radiance;     // light gathered so far
+    // The density with which the last bounce chose the direction of path;
+    // 0 for the camera ray and after specular bounces, which light sampling
+    // cannot produce.
+    real scatter_pdf;
+    int bounce;
+};
+
+// A shadow ray towards a sampled light, and the radiance it brings if
+// nothing blocks it before t_max.
+struct shadow_query {
+    ray r;
+    real t_max;
+    color contribution;
+};
+
+// What tracing paths took, counted per thread and added to render_counters.
+struct path_counts {
+    int64_t rays = 0;       // intersection and shadow rays
+    int64_t bounces = 0;    // times shade() sent a path on
+};
+
+// The path of a camera ray, before its first intersection.
+path_state start_path(const ray& r);
+// Ends p on a ray that leaves the scene.
+void miss(path_state& p, const render_settings& settings);
+// Takes p one bounce further at its intersection rec: adds what the surface
+// emits, samples a light (has_shadow says whether shadow must then be
+// tested) and scatters, with Russian roulette. Returns false once the path
+// ends. ray_color strings these together; the stages of trace_wavefront
+// call them for a whole batch of paths at once.
+bool shade(path_state& p, const hit_record& rec, const material_table& materials, const light_list& lights, const render_settings& settings,
+    shadow_query& shadow, bool& has_shadow, path_counts& counts);
+
+// Radiance arriving along r; counts receives the rays traced for it, shadow
+// rays included, and its bounces. After roulette_depth bounces a path survives with a
+// probability that follows its throughput. With light_sampling, diffuse
+// bounces also send a shadow ray to a light picked from lights, combined
+// with the bounce itself by multiple importance sampling.
+color ray_color(const ray& r, const hittable& world, const material_table& materials, const light_list& lights, const render_settings& settings, path_counts& counts);
+// The same for a ray whose first intersection is already known: hit tells
+// whether it has one, rec what it is.
+color ray_color(const ray& r, bool hit, const hit_record& rec, const hittable& world, const material_table& materials, const light_list& lights, const render_settings& settings, path_counts& counts);
+
+// The camera ray of the given sample of pixel (i, j). It restarts the
+// random stream of that sample, which the path then carries on.
+ray camera_ray(const camera& cam, const render_settings& settings, int i, int j, int sample);
+
+void add_sample(pixel_state& p, const color& c);
+bool converged(const pixel_state& p, double threshold);
+void write_pixel(unsigned char* out, const pixel_state& p, const render_settings& settings);
+
+// Samples every pixel up to samples_per_pixel and resolves it into
+// image_data, adding to what pixels already holds. Returns once the render
+// is done or cancel becomes true, which another thread may set. A
+// progressive render finishes the pass it is in, so the pixels always hold
+// whole passes and the render can be continued. utilization receives the
+// busy fraction of each thread.
+void render(const hittable& world, const material_table& materials, const light_list& lights, const camera& cam, const render_settings& settings,
+    unsigned char* image_data, pixel_state* pixels, render_counters& counters, float* utilization, const std::atomic<bool>& cancel);
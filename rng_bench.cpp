@@ -0,0 +1,50 @@
+// Microbenchmark of random_double(): the thread-local pcg32 the renderer
+// draws from, against the function-local mt19937 behind a std::function it
+// replaced, and a plain mt19937 without the indirect call.
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+
+#include "rtweekend.h"
+
+namespace {
+
+const int count = 100000000;    // samples per generator
+
+// The random_double() the renderer used before pcg32.
+double mt19937_function_double() {
+    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    static std::mt19937 generator;
+    static std::function<double()> rand_generator = std::bind(distribution, generator);
+    return rand_generator();
+}
+
+double mt19937_double() {
+    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    static std::mt19937 generator;
+    return distribution(generator);
+}
+
+// Draws count samples and prints the rate. Printing their mean keeps the
+// compiler from dropping the work, and shows the generator is sane.
+template <typename Next>
+void run(const char* name, Next&& next) {
+    auto start = std::chrono::steady_clock::now();
+    double sum = 0;
+    for (int i = 0; i < count; ++i)
+        sum += next();
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-22s %10.3g samples/s  mean %.4f\n", name, count / seconds, sum / count);
+}
+
+}
+
+int main()
+{
+    run("pcg32", [] { return random_double(); });
+    run("mt19937", mt19937_double);
+    run("mt19937 std::function", mt19937_function_double);
+    return 0;
+}
@@ -1,8 +1,8 @@
 #pragma once
 
 #include <cmath>
-#include <functional>
-#include <random>
+#include <cstdint>
+#include <cstring>
 #include <limits>
 #include <memory>
 
@@ -12,24 +12,109 @@
 using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
+using std::fabs;
+using std::fmin;
+using std::fmax;
+
+// The scalar type of geometry, rays and shading. Building with RT_FLOAT
+// halves the size of every vector and doubles the SIMD width; hit points
+// then carry float-sized error bounds, which spawn_ray offsets past.
+#if defined(RT_FLOAT)
+using real = float;
+using real_bits = uint32_t;
+#else
+using real = double;
+using real_bits = uint64_t;
+#endif
 
 // Constants
 
-const double epsilon = std::numeric_limits<double>::epsilon();
-const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.1415926535897932385;
+const real epsilon = std::numeric_limits<real>::epsilon();
+const real infinity = std::numeric_limits<real>::infinity();
+const real pi = real(3.1415926535897932385);
 
 // Utility Functions
 
-inline double degrees_to_radians(double degrees) {
+// Bound on the relative rounding error of n chained floating-point
+// operations (Higham's gamma_n, as used by pbrt).
+inline real error_gamma(int n) {
+    return (n * epsilon / 2) / (1 - n * epsilon / 2);
+}
+
+// The next representable real above / below v (pbrt's NextFloatUp/Down),
+// without the library call and errno handling of nextafter.
+inline real next_real_up(real v) {
+    if (std::isinf(v) && v > 0)
+        return v;
+    if (v == -0.0)
+        v = 0.0;
+    real_bits bits;
+    std::memcpy(&bits, &v, sizeof(v));
+    bits = v >= 0 ? bits + 1 : bits - 1;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+inline real next_real_down(real v) {
+    if (std::isinf(v) && v < 0)
+        return v;
+    if (v == 0.0)
+        v = -0.0;
+    real_bits bits;
+    std::memcpy(&bits, &v, sizeof(v));
+    bits = v > 0 ? bits - 1 : bits + 1;
+    std::memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+inline real degrees_to_radians(real degrees) {
     return degrees * pi / 180;
 }
 
+// PCG32 (O'Neill, pcg-random.org): 64 bits of state, 32-bit outputs.
+struct pcg32 {
+    uint64_t state = 0x853c49e6748fea9bULL;
+    uint64_t inc = 0xda3e39cb94b95bdbULL;
+
+    void seed(uint64_t init_state, uint64_t sequence) {
+        state = 0;
+        inc = (sequence << 1u) | 1u;
+        next();
+        state += init_state;
+        next();
+    }
+
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        auto xorshifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+        auto rot = static_cast<uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((0u - rot) & 31u));
+    }
+};
+
+inline uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Every thread draws from its own generator.
+inline pcg32& thread_rng() {
+    thread_local pcg32 rng;
+    return rng;
+}
+
+// Restarts the calling thread's stream at a point that depends only on
+// (pixel, sample, frame), so a render does not depend on the thread count.
+inline void seed_random(uint64_t pixel, uint32_t sample, uint32_t frame) {
+    thread_rng().seed(splitmix64(pixel ^ (uint64_t(frame) << 40)), splitmix64(sample));
+}
+
 inline double random_double() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    static std::function<double()> rand_generator = std::bind(distribution, generator);
-    return rand_generator();
+    // Returns a random real in [0,1).
+    return thread_rng().next() * (1.0 / 4294967296.0);
 }
 
 inline double random_double(double min, double max) {
@@ -0,0 +1,120 @@
+#include "scene.h"
+#include "bvh_cache.h"
+#include "sphere.h"
+#include "sphere_batch.h"
+#include "wide_bvh.h"
+
+scene_view random_scene(hittable_list& world, material_table& materials) {
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, materials.add(lambertian(color(0.5, 0.5, 0.5)))));
+    for (int a = -11; a < 11; ++a) {
+        for (int b = -11; b < 11; ++b) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+            if ((center - vec3(4, 0.2, 0)).length() > 0.9) {
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    world.add(make_shared<sphere>(center, 0.2, materials.add(lambertian(albedo))));
+                } else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(.5, 1);
+                    auto fuzz = random_double(0, .5);
+                    world.add(make_shared<sphere>(center, 0.2, materials.add(metal(albedo, fuzz))));
+                } else {
+                    // glass
+                    world.add(make_shared<sphere>(center, 0.2, materials.add(dielectric(1.5))));
+                }
+            }
+        }
+    }
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, materials.add(dielectric(1.5))));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, materials.add(lambertian(color(.4, .2, .1)))));
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, materials.add(metal(color(.7, .6, .5), 0.0))));
+    return { point3(13, 2, 3), point3(0, 0, 0), vec3(0, 1, 0), 20, 0.1, 10, true };
+}
+
+scene_view indoor_scene(hittable_list& world, material_table& materials) {
+    auto white = materials.add(lambertian(color(.75, .75, .75)));
+    auto red = materials.add(lambertian(color(.75, .25, .25)));
+    auto blue = materials.add(lambertian(color(.25, .25, .75)));
+    world.add(make_shared<sphere>(point3(1e5 + 1, 40.8, 81.6), 1e5, red));          // left
+    world.add(make_shared<sphere>(point3(-1e5 + 99, 40.8, 81.6), 1e5, blue));       // right
+    world.add(make_shared<sphere>(point3(50, 40.8, 1e5), 1e5, white));              // back
+    world.add(make_shared<sphere>(point3(50, 40.8, -1e5 + 170), 1e5, white));       // front
+    world.add(make_shared<sphere>(point3(50, 1e5, 81.6), 1e5, white));              // floor
+    world.add(make_shared<sphere>(point3(50, -1e5 + 81.6, 81.6), 1e5, white));      // ceiling
+    world.add(make_shared<sphere>(point3(27, 16.5, 47), 16.5, materials.add(metal(color(.999, .999, .999), 0.0))));
+    world.add(make_shared<sphere>(point3(73, 16.5, 78), 16.5, materials.add(dielectric(1.5))));
+    world.add(make_shared<sphere>(point3(48, 8, 92), 8, materials.add(lambertian(color(.8, .7, .2)))));
+    world.add(make_shared<sphere>(point3(50, 72, 81.6), 3, materials.add(diffuse_light(color(60, 60, 60)))));
+    return { point3(50, 45, 165), point3(50, 38, 0), vec3(0, 1, 0), 60, 0, 10, false };
+}
+
+shared_ptr<triangle_mesh> make_torus(const point3& center, real major, real minor, int rings, int sides, uint32_t mat_id, bvh_build method) {
+    auto mesh = make_shared<triangle_mesh>(mat_id);
+    mesh->positions.reserve(3 * size_t(rings) * sides);
+    mesh->indices.reserve(6 * size_t(rings) * sides);
+    for (int i = 0; i < rings; ++i) {
+        auto u = 2 * pi * i / rings;
+        for (int j = 0; j < sides; ++j) {
+            auto v = 2 * pi * j / sides;
+            auto tube = minor * (1 + 0.1 * sin(7 * u) * sin(5 * v));
+            auto from_axis = major + tube * cos(v);
+            mesh->add_vertex(center + vec3(from_axis * cos(u), tube * sin(v), -from_axis * sin(u)));
+        }
+    }
+    for (int i = 0; i < rings; ++i) {
+        for (int j = 0; j < sides; ++j) {
+            auto a = uint32_t(i * sides + j);
+            auto b = uint32_t((i + 1) % rings * sides + j);
+            auto c = uint32_t((i + 1) % rings * sides + (j + 1) % sides);
+            auto d = uint32_t(i * sides + (j + 1) % sides);
+            mesh->add_triangle(a, b, c);
+            mesh->add_triangle(a, c, d);
+        }
+    }
+    mesh->smooth_normals();
+    build_cached(*mesh, method);
+    return mesh;
+}
+
+scene_view mesh_scene(hittable_list& world, material_table& materials, int rings, int sides) {
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, materials.add(lambertian(color(0.5, 0.5, 0.5)))));
+    world.add(make_torus(point3(0, 0.6, 0), 1.6, 0.6, rings, sides, materials.add(lambertian(color(.8, .35, .2)))));
+    world.add(make_shared<sphere>(point3(0, 0.7, 0), 0.7, materials.add(dielectric(1.5))));
+    world.add(make_shared<sphere>(point3(-3.2, 0.5, 1.5), 0.5, materials.add(metal(color(.7, .6, .5), 0.05))));
+    return { point3(0, 4.5, 8), point3(0, 0.5, 0), vec3(0, 1, 0), 35, 0, 8.5, true };
+}
+
+scene_view model_scene(shared_ptr<triangle_mesh> mesh, hittable_list& world, material_table& materials) {
+    aabb box;
+    mesh->bounding_box(box);
+    auto center = box.centroid();
+    auto radius = fmax(real(0.5) * (box.max() - box.min()).length(), real(1e-3));
+    world.add(make_shared<sphere>(point3(center.x(), box.min().y() - 1000 * radius, center.z()), 1000 * radius,
+        materials.add(lambertian(color(0.5, 0.5, 0.5)))));
+    mesh->mat_id = materials.add(lambertian(color(.8, .35, .2)));
+    world.add(mesh);
+    // Far enough back for a 35 degree view to hold the bounding sphere.
+    point3 look_from = center + radius * vec3(0, 1.2, 3.3);
+    return { look_from, center, vec3(0, 1, 0), 35, 0, (look_from - center).length(), true };
+}
+
+scene_view make_scene(scene_kind kind, hittable_list& world, material_table& materials) {
+    // A fresh generator, so a scene comes out the same every time it is made.
+    thread_rng() = pcg32();
+    switch (kind) {
+    case scene_kind::indoor: return indoor_scene(world, materials);
+    case scene_kind::mesh: return mesh_scene(world, materials);
+    default: return random_scene(world, materials);
+    }
+}
+
+shared_ptr<hittable> build_accel(const hittable_list& world, accel_structure accel, bvh_build method) {
+    switch (accel) {
+    case accel_structure::bvh: return make_shared<bvh>(world, method);
+    case accel_structure::bvh4: return make_shared<bvh4>(world, method);
+    case accel_structure::bvh8: return make_shared<bvh8>(world, method);
+    default: return make_shared<sphere_batch>(world, method);
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "bvh.h"
+#include "triangle_mesh.h"
+
+enum class scene_kind {
+    random,     // the book's final scene under the sky
+    indoor,     // a closed room lit by one small light
+    mesh        // a finely tessellated torus of a million triangles
+};
+
+// Where a scene is meant to be looked at from, and what lies behind it.
+struct scene_view {
+    point3 look_from;
+    point3 look_at;
+    vec3 view_up;
+    double fov;
+    double aperture;
+    double focus_dist;
+    bool sky;           // sky gradient behind the scene, else black
+};
+
+enum class accel_structure {
+    bvh,
+    bvh4,
+    bvh8,
+    sphere_batch    // spheres batched, other objects in a BVH beside them
+};
+
+// The final scene of the book: a large ground sphere, three big spheres and
+// a grid of small ones with random materials.
+scene_view random_scene(hittable_list& world, material_table& materials);
+
+// A box room in the manner of smallpt, its walls the inner surfaces of
+// huge spheres, holding a mirror, a glass and a diffuse ball under a small
+// spherical light. Only the light lights it.
+scene_view indoor_scene(hittable_list& world, material_table& materials);
+
+// A ground sphere and glass ball under the sky, around a torus with a
+// rippled tube made of 2 * rings * sides triangles.
+scene_view mesh_scene(hittable_list& world, material_table& materials, int rings = 1000, int sides = 500);
+
+// A loaded mesh, built, resting on a ground sphere under the sky and seen
+// from the front and a little above so that all of it is in view. The
+// mesh gets a diffuse material.
+scene_view model_scene(shared_ptr<triangle_mesh> mesh, hittable_list& world, material_table& materials);
+
+// A torus around the y axis through center, with radius major from the
+// axis to the middle of the tube and a tube of radius minor, rippled by a
+// tenth of it. The tube is cut into rings around the axis and every ring
+// into sides quads of two triangles each. Vertex normals are smoothed. The
+// BVH comes from the cache if one is set, see set_bvh_cache_directory.
+shared_ptr<triangle_mesh> make_torus(const point3& center, real major, real minor, int rings, int sides, uint32_t mat_id, bvh_build method = bvh_build::lbvh);
+
+// Adds the scene of the given kind to world and materials.
+scene_view make_scene(scene_kind kind, hittable_list& world, material_table& materials);
+
+// Builds the acceleration structure rendered in place of world.
+shared_ptr<hittable> build_accel(const hittable_list& world, accel_structure accel, bvh_build method);
@@ -1,32 +1,32 @@
 #include "sphere.h"
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    vec3 oc = r.origin() - center;
-    auto a = r.direction().length_squared();
-    auto half_b = dot(oc, r.direction());
-    auto c = oc.length_squared() - radius * radius;
-    auto discriminant = half_b * half_b - a * c;
+bool sphere::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    real near, far;
+    if (!sphere_roots(r, center, radius, near, far))
+        return false;
 
-    if (discriminant > 0) {
-        auto root = sqrt(discriminant);
-        auto temp = (-half_b - root) / a;
-        if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
-            return true;
-        }
-        temp = (-half_b + root) / a;
-        if (temp < t_max && temp > t_min) {
-            rec.t = temp;
-            rec.p = r.at(rec.t);
-            vec3 outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat_ptr = mat_ptr;
-            return true;
-        }
+    auto temp = near;
+    if (!(temp < t_max && temp > t_min)) {
+        temp = far;
+        if (!(temp < t_max && temp > t_min))
+            return false;
     }
-    return false;
+    rec.t = temp;
+    set_sphere_hit(r, center, radius, rec);
+    rec.mat_id = mat_id;
+    return true;
+}
+
+bool sphere::occluded(const ray& r, real t_min, real t_max) const {
+    real near, far;
+    if (!sphere_roots(r, center, radius, near, far))
+        return false;
+    return (near < t_max && near > t_min) || (far < t_max && far > t_min);
+}
+
+bool sphere::bounding_box(aabb& output_box) const {
+    output_box = aabb(
+        center - vec3(radius, radius, radius),
+        center + vec3(radius, radius, radius));
+    return true;
 }
@@ -3,16 +3,58 @@
 #include "hittable.h"
 #include "vec3.h"
 
+#include <utility>
+
+// Fills in p, p_error and the normal of rec for r hitting the sphere at
+// rec.t. The hit point is projected back onto the surface, which leaves an
+// error of a few ulps of its distance from the center (pbrt, 3.9.4) plus
+// the rounding of adding the center back.
+inline void set_sphere_hit(const ray& r, const point3& center, real radius, hit_record& rec) {
+    vec3 local = r.at(rec.t) - center;
+    local *= radius / local.length();
+    rec.p = center + local;
+    rec.p_error = error_gamma(6) * vec3(
+        fabs(center.x()) + fabs(local.x()),
+        fabs(center.y()) + fabs(local.y()),
+        fabs(center.z()) + fabs(local.z()));
+    rec.set_face_normal(r, local / radius);
+}
+
+// The roots t0 <= t1 of r meeting the sphere, if it does. The discriminant
+// comes from the distance between the center and the ray's line instead of
+// b^2 - ac, and the roots from the stable form of the quadratic formula, so
+// both hold up in single precision for spheres that are large or far from
+// the origin (Ray Tracing Gems, chapter 7).
+inline bool sphere_roots(const ray& r, const point3& center, real radius, real& t0, real& t1) {
+    vec3 oc = r.orig - center;
+    auto a = r.dir.length_squared();
+    auto half_b = dot(oc, r.dir);
+    vec3 l = oc - (half_b / a) * r.dir;
+    auto discriminant = a * (radius * radius - l.length_squared());
+    if (discriminant <= 0)
+        return false;
+
+    auto c = oc.length_squared() - radius * radius;
+    auto q = -(half_b + std::copysign(sqrt(discriminant), half_b));
+    t0 = c / q;
+    t1 = q / a;
+    if (t0 > t1)
+        std::swap(t0, t1);
+    return true;
+}
+
 class sphere : public hittable {
 public:
     sphere() {}
-    sphere(point3 cen, double r, shared_ptr<material> m)
-        : center(cen), radius(r), mat_ptr(m) {};
+    sphere(point3 cen, real r, uint32_t m)
+        : center(cen), radius(r), mat_id(m) {};
 
-    virtual bool hit(const ray& r, double tmin, double tmax, hit_record& rec) const;
+    virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+    virtual bool bounding_box(aabb& output_box) const;
+    virtual bool occluded(const ray& r, real tmin, real tmax) const;
 
 public:
     point3 center;
-    double radius;
-    shared_ptr<material> mat_ptr;
+    real radius;
+    uint32_t mat_id;
 };
@@ -0,0 +1,258 @@
+#include "sphere_batch.h"
+#include "sphere.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+namespace {
+
+// The few lane operations hit_range needs, on 8 floats or 4 doubles to
+// match real.
+#if defined(RT_FLOAT)
+using lanes = __m256;
+const int lane_count = 8;
+inline lanes vset1(real x) { return _mm256_set1_ps(x); }
+inline lanes vadd(lanes a, lanes b) { return _mm256_add_ps(a, b); }
+inline lanes vsub(lanes a, lanes b) { return _mm256_sub_ps(a, b); }
+inline lanes vmul(lanes a, lanes b) { return _mm256_mul_ps(a, b); }
+inline lanes vdiv(lanes a, lanes b) { return _mm256_div_ps(a, b); }
+inline lanes vsqrt(lanes a) { return _mm256_sqrt_ps(a); }
+inline lanes vmin(lanes a, lanes b) { return _mm256_min_ps(a, b); }
+inline lanes vmax(lanes a, lanes b) { return _mm256_max_ps(a, b); }
+inline lanes vand(lanes a, lanes b) { return _mm256_and_ps(a, b); }
+inline lanes vor(lanes a, lanes b) { return _mm256_or_ps(a, b); }
+inline lanes vxor(lanes a, lanes b) { return _mm256_xor_ps(a, b); }
+inline lanes vgt(lanes a, lanes b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline lanes vlt(lanes a, lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+inline lanes vselect(lanes mask, lanes a, lanes b) { return _mm256_blendv_ps(b, a, mask); }
+inline int vbits(lanes mask) { return _mm256_movemask_ps(mask); }
+inline void vstore(real* p, lanes a) { _mm256_store_ps(p, a); }
+// All bits set in the first n lanes.
+inline __m256i first_lanes(int n) { return _mm256_cmpgt_epi32(_mm256_set1_epi32(n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)); }
+inline lanes vload(const real* p, __m256i mask) { return _mm256_maskload_ps(p, mask); }
+inline lanes vmask(__m256i mask) { return _mm256_castsi256_ps(mask); }
+#else
+using lanes = __m256d;
+const int lane_count = 4;
+inline lanes vset1(real x) { return _mm256_set1_pd(x); }
+inline lanes vadd(lanes a, lanes b) { return _mm256_add_pd(a, b); }
+inline lanes vsub(lanes a, lanes b) { return _mm256_sub_pd(a, b); }
+inline lanes vmul(lanes a, lanes b) { return _mm256_mul_pd(a, b); }
+inline lanes vdiv(lanes a, lanes b) { return _mm256_div_pd(a, b); }
+inline lanes vsqrt(lanes a) { return _mm256_sqrt_pd(a); }
+inline lanes vmin(lanes a, lanes b) { return _mm256_min_pd(a, b); }
+inline lanes vmax(lanes a, lanes b) { return _mm256_max_pd(a, b); }
+inline lanes vand(lanes a, lanes b) { return _mm256_and_pd(a, b); }
+inline lanes vor(lanes a, lanes b) { return _mm256_or_pd(a, b); }
+inline lanes vxor(lanes a, lanes b) { return _mm256_xor_pd(a, b); }
+inline lanes vgt(lanes a, lanes b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+inline lanes vlt(lanes a, lanes b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+inline lanes vselect(lanes mask, lanes a, lanes b) { return _mm256_blendv_pd(b, a, mask); }
+inline int vbits(lanes mask) { return _mm256_movemask_pd(mask); }
+inline void vstore(real* p, lanes a) { _mm256_store_pd(p, a); }
+inline __m256i first_lanes(int n) { return _mm256_cmpgt_epi64(_mm256_set1_epi64x(n), _mm256_set_epi64x(3, 2, 1, 0)); }
+inline lanes vload(const real* p, __m256i mask) { return _mm256_maskload_pd(p, mask); }
+inline lanes vmask(__m256i mask) { return _mm256_castsi256_pd(mask); }
+#endif
+
+}
+#endif
+
+sphere_batch::sphere_batch(const hittable_list& list, bvh_build method) {
+    hittable_list rest;
+    for (const auto& object : list.objects) {
+        auto s = std::dynamic_pointer_cast<sphere>(object);
+        if (!s) {
+            rest.add(object);
+            continue;
+        }
+        center_x.push_back(s->center.x());
+        center_y.push_back(s->center.y());
+        center_z.push_back(s->center.z());
+        radius.push_back(s->radius);
+        mat_id.push_back(s->mat_id);
+    }
+    build(method);
+    if (!rest.objects.empty())
+        others = make_shared<bvh8>(rest, method);
+}
+
+void sphere_batch::add(point3 center, real r, uint32_t m) {
+    center_x.push_back(center.x());
+    center_y.push_back(center.y());
+    center_z.push_back(center.z());
+    radius.push_back(r);
+    mat_id.push_back(m);
+}
+
+void sphere_batch::build(bvh_build method) {
+    auto n = static_cast<int64_t>(size());
+    std::vector<aabb> boxes(n);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < n; ++i) {
+        vec3 extent(radius[i], radius[i], radius[i]);
+        point3 center(center_x[i], center_y[i], center_z[i]);
+        boxes[i] = aabb(center - extent, center + extent);
+    }
+
+    std::vector<uint32_t> order;
+    linear_bvh binary(boxes, order, method);
+    tree = linear_wide_bvh<8>(binary);
+    box = binary.bounds();
+
+    auto reorder = [&](auto& values) {
+        auto sorted = values;
+        #pragma omp parallel for
+        for (int64_t i = 0; i < n; ++i)
+            sorted[i] = values[order[i]];
+        values.swap(sorted);
+    };
+    reorder(center_x);
+    reorder(center_y);
+    reorder(center_z);
+    reorder(radius);
+    reorder(mat_id);
+}
+
+int64_t sphere_batch::hit_range(const ray& r, uint32_t first, uint32_t count, real t_min, real& t_max) const {
+    int64_t closest = -1;
+
+#if defined(__AVX2__)
+    // The same roots as sphere_roots, lane by lane.
+    auto ox = vset1(r.orig.x()), oy = vset1(r.orig.y()), oz = vset1(r.orig.z());
+    auto dx = vset1(r.dir.x()), dy = vset1(r.dir.y()), dz = vset1(r.dir.z());
+    auto va = vset1(r.dir.length_squared());
+    auto vt_min = vset1(t_min);
+    auto zero = vset1(0);
+    auto sign_bit = vset1(-real(0));
+
+    for (uint32_t i = first; i < first + count; i += lane_count) {
+        // Masked loads keep the last chunk of a leaf inside the arrays.
+        auto load_mask = first_lanes(static_cast<int>(first + count - i));
+        auto ocx = vsub(ox, vload(&center_x[i], load_mask));
+        auto ocy = vsub(oy, vload(&center_y[i], load_mask));
+        auto ocz = vsub(oz, vload(&center_z[i], load_mask));
+        auto rad = vload(&radius[i], load_mask);
+
+        auto half_b = vadd(vadd(vmul(ocx, dx), vmul(ocy, dy)), vmul(ocz, dz));
+        auto s = vdiv(half_b, va);
+        auto lx = vsub(ocx, vmul(s, dx)), ly = vsub(ocy, vmul(s, dy)), lz = vsub(ocz, vmul(s, dz));
+        auto l_squared = vadd(vadd(vmul(lx, lx), vmul(ly, ly)), vmul(lz, lz));
+        auto discriminant = vmul(va, vsub(vmul(rad, rad), l_squared));
+        auto valid = vand(vmask(load_mask), vgt(discriminant, zero));
+        if (!vbits(valid))
+            continue;
+
+        auto c = vsub(vadd(vadd(vmul(ocx, ocx), vmul(ocy, ocy)), vmul(ocz, ocz)), vmul(rad, rad));
+        auto root = vor(vsqrt(discriminant), vand(half_b, sign_bit));
+        auto q = vxor(vadd(half_b, root), sign_bit);
+        auto r0 = vdiv(c, q), r1 = vdiv(q, va);
+        auto t0 = vmin(r0, r1), t1 = vmax(r0, r1);
+
+        // Same root choice as sphere::hit: the near root if in range, else the far one.
+        auto vt_max = vset1(t_max);
+        auto in0 = vand(vlt(t0, vt_max), vgt(t0, vt_min));
+        auto in1 = vand(vlt(t1, vt_max), vgt(t1, vt_min));
+        auto t = vselect(in0, t0, t1);
+        auto hit_mask = vbits(vand(valid, vor(in0, in1)));
+        if (!hit_mask)
+            continue;
+
+        alignas(32) real ts[lane_count];
+        vstore(ts, t);
+        for (int k = 0; k < lane_count; ++k) {
+            if ((hit_mask & (1 << k)) && ts[k] < t_max) {
+                t_max = ts[k];
+                closest = i + k;
+            }
+        }
+    }
+#else
+    for (uint32_t i = first; i < first + count; ++i) {
+        real t0, t1;
+        if (sphere_roots(r, point3(center_x[i], center_y[i], center_z[i]), radius[i], t0, t1)) {
+            auto temp = t0;
+            if (!(temp < t_max && temp > t_min))
+                temp = t1;
+            if (temp < t_max && temp > t_min) {
+                t_max = temp;
+                closest = i;
+            }
+        }
+    }
+#endif
+
+    return closest;
+}
+
+bool sphere_batch::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    int64_t closest = -1;
+    tree.traverse(r, t_min, t_max, [&](uint32_t first, uint32_t count, real& t) {
+        auto i = hit_range(r, first, count, t_min, t);
+        if (i < 0)
+            return false;
+        closest = i;
+        rec.t = t;
+        return true;
+    });
+    if (closest >= 0) {
+        set_sphere_hit(r, point3(center_x[closest], center_y[closest], center_z[closest]), radius[closest], rec);
+        rec.mat_id = mat_id[closest];
+    }
+    if (others && others->hit(r, t_min, closest >= 0 ? rec.t : t_max, rec))
+        return true;
+    return closest >= 0;
+}
+
+bool sphere_batch::occluded(const ray& r, real t_min, real t_max) const {
+    if (others && others->occluded(r, t_min, t_max))
+        return true;
+    return tree.occluded(r, t_min, t_max, [&](uint32_t first, uint32_t count) {
+        // A leaf is a single kernel call, so looking for the closest hit in
+        // it costs no more than stopping at the first.
+        auto t = t_max;
+        return hit_range(r, first, count, t_min, t) >= 0;
+    });
+}
+
+void sphere_batch::hit_packet(const ray* rays, int count, real t_min, real t_max, hit_record* recs, bool* hits) const {
+    real closest_t[max_packet_size];
+    int64_t closest[max_packet_size];
+    for (int k = 0; k < count; ++k) {
+        closest_t[k] = t_max;
+        closest[k] = -1;
+    }
+    tree.traverse_packet(rays, count, t_min, closest_t, [&](uint32_t first, uint32_t n, uint32_t mask, real* t) {
+        for (int k = 0; k < count; ++k) {
+            if (!(mask & (1u << k)))
+                continue;
+            auto i = hit_range(rays[k], first, n, t_min, t[k]);
+            if (i >= 0)
+                closest[k] = i;
+        }
+    });
+
+    for (int k = 0; k < count; ++k) {
+        hits[k] = closest[k] >= 0;
+        if (!hits[k])
+            continue;
+        auto i = closest[k];
+        recs[k].t = closest_t[k];
+        set_sphere_hit(rays[k], point3(center_x[i], center_y[i], center_z[i]), radius[i], recs[k]);
+        recs[k].mat_id = mat_id[i];
+    }
+    if (others) {
+        for (int k = 0; k < count; ++k) {
+            if (others->hit(rays[k], t_min, hits[k] ? recs[k].t : t_max, recs[k]))
+                hits[k] = true;
+        }
+    }
+}
+
+bool sphere_batch::bounding_box(aabb& output_box) const {
+    output_box = box;
+    aabb others_box;
+    if (others && others->bounding_box(others_box))
+        output_box = surrounding_box(output_box, others_box);
+    return !tree.nodes.empty() || others;
+}
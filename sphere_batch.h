@@ -0,0 +1,42 @@
+#pragma once
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "bvh.h"
+#include "wide_bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+// Spheres stored as structure of arrays in BVH leaf order, so a leaf is
+// intersected by one vectorized kernel instead of a virtual call per sphere.
+// The hierarchy over them is an 8-wide BVH. Objects other than spheres,
+// such as meshes, get a BVH of their own that is tested alongside.
+class sphere_batch : public hittable {
+public:
+    sphere_batch() {}
+    // Takes over the spheres of list and puts the other objects into others.
+    sphere_batch(const hittable_list& list, bvh_build method = bvh_build::sah);
+
+    void add(point3 center, real radius, uint32_t m);
+    // Builds the hierarchy and sorts the spheres into its leaf order.
+    void build(bvh_build method = bvh_build::sah);
+    size_t size() const { return radius.size(); }
+
+    virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+    virtual bool bounding_box(aabb& output_box) const;
+    virtual bool occluded(const ray& r, real tmin, real tmax) const;
+    virtual void hit_packet(const ray* rays, int count, real tmin, real tmax, hit_record* recs, bool* hits) const;
+
+    // Returns the closest sphere of [first, first + count) hit within
+    // (t_min, t_max) and shrinks t_max to it, or -1.
+    int64_t hit_range(const ray& r, uint32_t first, uint32_t count, real t_min, real& t_max) const;
+
+public:
+    std::vector<real> center_x, center_y, center_z;
+    std::vector<real> radius;
+    std::vector<uint32_t> mat_id;
+    linear_wide_bvh<8> tree;
+    aabb box;                       // of the spheres
+    shared_ptr<hittable> others;    // everything in list that is not a sphere, or null
+};
@@ -0,0 +1,140 @@
+#include "tile_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include <omp.h>
+
+namespace {
+
+// Position d along a Hilbert curve filling an n x n grid, n a power of two.
+void hilbert_d2xy(int n, int d, int& x, int& y) {
+    x = y = 0;
+    for (int s = 1; s < n; s *= 2) {
+        int rx = 1 & (d / 2);
+        int ry = 1 & (d ^ rx);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += s * rx;
+        y += s * ry;
+        d /= 4;
+    }
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+tile_scheduler::tile_scheduler(int image_width, int image_height, int tile_size, tile_order order) {
+    tile_size = std::max(tile_size, 1);
+    int tiles_x = (image_width + tile_size - 1) / tile_size;
+    int tiles_y = (image_height + tile_size - 1) / tile_size;
+
+    std::vector<std::pair<int, int>> cells;
+    cells.reserve(tiles_x * tiles_y);
+    switch (order) {
+    case tile_order::scanline:
+        for (int ty = 0; ty < tiles_y; ++ty)
+            for (int tx = 0; tx < tiles_x; ++tx)
+                cells.emplace_back(tx, ty);
+        break;
+    case tile_order::spiral: {
+        for (int ty = 0; ty < tiles_y; ++ty)
+            for (int tx = 0; tx < tiles_x; ++tx)
+                cells.emplace_back(tx, ty);
+        // Ring by ring around the center, each ring walked by angle.
+        double cx = (tiles_x - 1) / 2.0;
+        double cy = (tiles_y - 1) / 2.0;
+        auto ring = [&](const std::pair<int, int>& c) {
+            return std::max(std::fabs(c.first - cx), std::fabs(c.second - cy));
+        };
+        auto angle = [&](const std::pair<int, int>& c) {
+            return std::atan2(c.second - cy, c.first - cx);
+        };
+        std::stable_sort(cells.begin(), cells.end(), [&](const std::pair<int, int>& a, const std::pair<int, int>& b) {
+            auto ra = std::floor(ring(a) + 0.5), rb = std::floor(ring(b) + 0.5);
+            return ra != rb ? ra < rb : angle(a) < angle(b);
+        });
+        break;
+    }
+    case tile_order::hilbert: {
+        int n = 1;
+        while (n < tiles_x || n < tiles_y)
+            n *= 2;
+        for (int d = 0; d < n * n; ++d) {
+            int tx, ty;
+            hilbert_d2xy(n, d, tx, ty);
+            if (tx < tiles_x && ty < tiles_y)
+                cells.emplace_back(tx, ty);
+        }
+        break;
+    }
+    }
+
+    tiles.reserve(cells.size());
+    for (const auto& c : cells) {
+        int x0 = c.first * tile_size;
+        int y0 = c.second * tile_size;
+        tiles.push_back({ x0, y0, std::min(x0 + tile_size, image_width), std::min(y0 + tile_size, image_height) });
+    }
+}
+
+bool tile_scheduler::pop(int thread, int& index) {
+    {
+        auto& own = *queues[thread];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tiles.empty()) {
+            index = own.tiles.front();
+            own.tiles.pop_front();
+            return true;
+        }
+    }
+
+    // Steal the tile the victim would have reached last.
+    int count = static_cast<int>(queues.size());
+    for (int k = 1; k < count; ++k) {
+        auto& victim = *queues[(thread + k) % count];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tiles.empty()) {
+            index = victim.tiles.back();
+            victim.tiles.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void tile_scheduler::run(int threads, const std::function<void(const tile&)>& render_tile, const std::atomic<bool>& cancel) {
+    threads = std::max(threads, 1);
+    queues.clear();
+    for (int t = 0; t < threads; ++t)
+        queues.push_back(std::make_unique<work_queue>());
+    for (size_t i = 0; i < tiles.size(); ++i)
+        queues[i % threads]->tiles.push_back(static_cast<int>(i));
+    busy_seconds.assign(threads, 0);
+
+    auto start = std::chrono::steady_clock::now();
+    #pragma omp parallel num_threads(threads)
+    {
+        // The runtime may hand out fewer threads than asked for; the
+        // survivors steal the orphaned queues.
+        int thread = omp_get_thread_num();
+        double busy = 0;
+        int index;
+        while (!cancel && pop(thread, index)) {
+            auto tile_start = std::chrono::steady_clock::now();
+            render_tile(tiles[index]);
+            busy += seconds_since(tile_start);
+        }
+        busy_seconds[thread] = busy;
+    }
+    wall_seconds = seconds_since(start);
+}
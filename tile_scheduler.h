@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum class tile_order {
+    scanline,   // row by row from the top
+    spiral,     // rings outwards from the image center
+    hilbert     // along a Hilbert curve, keeping neighbouring tiles together
+};
+
+struct tile {
+    int x0, y0;     // first pixel
+    int x1, y1;     // one past the last pixel
+};
+
+// Splits an image into tiles and hands them to a team of threads. Tiles are
+// dealt round-robin in the chosen order into per-thread deques; a thread
+// works its own deque from the front and, once it runs dry, steals from the
+// back of the others.
+class tile_scheduler {
+public:
+    tile_scheduler(int image_width, int image_height, int tile_size, tile_order order);
+
+    // Calls render_tile for every tile on threads threads and returns when all
+    // are done; tiles not yet started are dropped once cancel becomes true.
+    void run(int threads, const std::function<void(const tile&)>& render_tile, const std::atomic<bool>& cancel);
+
+public:
+    std::vector<tile> tiles;            // in the chosen order
+    std::vector<double> busy_seconds;   // time each thread of the last run spent in render_tile
+    double wall_seconds = 0;            // duration of the last run
+
+private:
+    struct work_queue {
+        std::mutex lock;
+        std::deque<int> tiles;
+    };
+
+    bool pop(int thread, int& index);
+
+    std::vector<std::unique_ptr<work_queue>> queues;
+};
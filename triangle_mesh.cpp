@@ -0,0 +1,271 @@
+#include "triangle_mesh.h"
+
+#include <cstring>
+#include <utility>
+
+namespace {
+
+// A ray set up for the watertight test of Woop, Benthin and Wald (2013):
+// the coordinates are permuted so that z is the dominant axis of the
+// direction, and the shear sx, sy, sz turns the ray into the +z axis.
+// Triangles sharing an edge then compute the same edge function for it, so
+// no ray slips through between them.
+struct watertight_ray {
+    point3 orig;
+    int kx, ky, kz;
+    real sx, sy, sz;
+
+    explicit watertight_ray(const ray& r) : orig(r.orig) {
+        auto d = r.dir;
+        auto ax = fabs(d.x()), ay = fabs(d.y()), az = fabs(d.z());
+        kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+        kx = kz == 2 ? 0 : kz + 1;
+        ky = kx == 2 ? 0 : kx + 1;
+        // Keep the winding of the triangles.
+        if (d[kz] < 0)
+            std::swap(kx, ky);
+        sz = 1 / d[kz];
+        sx = d[kx] * sz;
+        sy = d[ky] * sz;
+    }
+};
+
+// Intersects r with the triangle p0 p1 p2. On a hit within (t_min, t_max)
+// sets t and the barycentric weights b of the three vertices.
+inline bool hit_triangle(const watertight_ray& r, const point3& p0, const point3& p1, const point3& p2, real t_min, real t_max, real& t, real* b) {
+    vec3 a = p0 - r.orig;
+    vec3 c = p2 - r.orig;
+    vec3 e = p1 - r.orig;
+    auto ax = a[r.kx] - r.sx * a[r.kz], ay = a[r.ky] - r.sy * a[r.kz];
+    auto bx = e[r.kx] - r.sx * e[r.kz], by = e[r.ky] - r.sy * e[r.kz];
+    auto cx = c[r.kx] - r.sx * c[r.kz], cy = c[r.ky] - r.sy * c[r.kz];
+
+    // Edge functions: twice the signed areas the ray splits the triangle into.
+    auto u = cx * by - cy * bx;
+    auto v = ax * cy - ay * cx;
+    auto w = bx * ay - by * ax;
+#if defined(RT_FLOAT)
+    // The ray runs through an edge in single precision; settle which side
+    // it is on in double, as the paper does.
+    if (u == 0 || v == 0 || w == 0) {
+        u = static_cast<real>(double(cx) * by - double(cy) * bx);
+        v = static_cast<real>(double(ax) * cy - double(ay) * cx);
+        w = static_cast<real>(double(bx) * ay - double(by) * ax);
+    }
+#endif
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+        return false;
+    auto det = u + v + w;
+    if (det == 0)
+        return false;
+
+    auto scaled_t = u * (r.sz * a[r.kz]) + v * (r.sz * e[r.kz]) + w * (r.sz * c[r.kz]);
+    t = scaled_t / det;
+    if (!(t > t_min && t < t_max))
+        return false;
+    auto inv_det = 1 / det;
+    b[0] = u * inv_det;
+    b[1] = v * inv_det;
+    b[2] = w * inv_det;
+    return true;
+}
+
+// The vertex positions of a mesh, looked up once per query rather than per
+// triangle.
+struct vertex_view {
+    const char* data;
+    size_t stride;
+
+    explicit vertex_view(const triangle_mesh& mesh) : data(mesh.position_data()), stride(mesh.position_stride()) {}
+
+    point3 operator[](uint32_t v) const {
+        float p[3];
+        memcpy(p, data + stride * v, sizeof(p));
+        return point3(p[0], p[1], p[2]);
+    }
+};
+
+// The closest triangle of [first, first + count) hit within (t_min, t_max),
+// or -1. Shrinks t_max to it and puts its barycentric weights in b.
+int64_t hit_range(const triangle_mesh& mesh, const vertex_view& vertices, const watertight_ray& r, uint32_t first, uint32_t count, real t_min, real& t_max, real* b) {
+    int64_t closest = -1;
+    for (auto i = first; i < first + count; ++i) {
+        const auto* v = &mesh.indices[3 * size_t(i)];
+        real t, weights[3];
+        if (hit_triangle(r, vertices[v[0]], vertices[v[1]], vertices[v[2]], t_min, t_max, t, weights)) {
+            t_max = t;
+            closest = i;
+            b[0] = weights[0];
+            b[1] = weights[1];
+            b[2] = weights[2];
+        }
+    }
+    return closest;
+}
+
+// Fills in rec for r hitting triangle at rec.t with barycentric weights b.
+// The point is interpolated from the vertices, which bounds its error by
+// gamma(7) times the sum of the weighted vertices (pbrt, 3.9.5).
+void set_triangle_hit(const triangle_mesh& mesh, const ray& r, uint32_t triangle, const real* b, hit_record& rec) {
+    const auto* v = &mesh.indices[3 * size_t(triangle)];
+    point3 p0 = mesh.vertex(v[0]), p1 = mesh.vertex(v[1]), p2 = mesh.vertex(v[2]);
+    vec3 b0 = b[0] * p0, b1 = b[1] * p1, b2 = b[2] * p2;
+    rec.p = b0 + b1 + b2;
+    rec.p_error = error_gamma(7) * vec3(
+        fabs(b0.x()) + fabs(b1.x()) + fabs(b2.x()),
+        fabs(b0.y()) + fabs(b1.y()) + fabs(b2.y()),
+        fabs(b0.z()) + fabs(b1.z()) + fabs(b2.z()));
+    rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+    rec.mat_id = mesh.mat_id;
+    const auto* normals = mesh.normal_data();
+    if (!normals)
+        return;
+
+    // Smooth shading: the interpolated vertex normal, on the side of the
+    // face the ray came from. The geometric normal stays for spawn_ray.
+    vec3 shading(0, 0, 0);
+    for (int k = 0; k < 3; ++k) {
+        float n[3];
+        memcpy(n, normals + mesh.normal_stride() * v[k], sizeof(n));
+        shading += b[k] * vec3(n[0], n[1], n[2]);
+    }
+    if (shading.length_squared() > 0) {
+        shading = unit_vector(shading);
+        rec.normal = dot(shading, rec.normal) < 0 ? -shading : shading;
+    }
+}
+
+}
+
+uint32_t triangle_mesh::add_vertex(const point3& p) {
+    auto v = static_cast<uint32_t>(vertex_count());
+    positions.push_back(static_cast<float>(p.x()));
+    positions.push_back(static_cast<float>(p.y()));
+    positions.push_back(static_cast<float>(p.z()));
+    return v;
+}
+
+void triangle_mesh::use_vertices(shared_ptr<const void> owner, const char* position_data, const char* normal_data, size_t count, size_t stride) {
+    positions.clear();
+    normals.clear();
+    vertex_owner = std::move(owner);
+    external_positions = position_data;
+    external_normals = normal_data;
+    external_count = count;
+    external_stride = stride;
+}
+
+void triangle_mesh::add_triangle(uint32_t a, uint32_t b, uint32_t c) {
+    indices.push_back(a);
+    indices.push_back(b);
+    indices.push_back(c);
+}
+
+void triangle_mesh::smooth_normals() {
+    std::vector<vec3> sum(vertex_count(), vec3(0, 0, 0));
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        auto a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        // The cross product is twice the area of the face.
+        auto n = cross(vertex(b) - vertex(a), vertex(c) - vertex(a));
+        sum[a] += n;
+        sum[b] += n;
+        sum[c] += n;
+    }
+    normals.resize(3 * vertex_count());
+    for (size_t v = 0; v < sum.size(); ++v) {
+        auto n = sum[v].length_squared() > 0 ? unit_vector(sum[v]) : sum[v];
+        normals[3 * v] = static_cast<float>(n.x());
+        normals[3 * v + 1] = static_cast<float>(n.y());
+        normals[3 * v + 2] = static_cast<float>(n.z());
+    }
+}
+
+void triangle_mesh::build(bvh_build method) {
+    auto n = static_cast<int64_t>(size());
+    std::vector<aabb> boxes(n);
+    #pragma omp parallel for
+    for (int64_t i = 0; i < n; ++i) {
+        auto p0 = vertex(indices[3 * i]), p1 = vertex(indices[3 * i + 1]), p2 = vertex(indices[3 * i + 2]);
+        boxes[i] = surrounding_box(aabb(p0, p0), surrounding_box(aabb(p1, p1), aabb(p2, p2)));
+    }
+
+    std::vector<uint32_t> order;
+    linear_bvh binary(boxes, order, method);
+    tree = linear_wide_bvh<8>(binary);
+    box = binary.bounds();
+
+    std::vector<uint32_t> sorted(indices.size());
+    #pragma omp parallel for
+    for (int64_t i = 0; i < n; ++i) {
+        for (int k = 0; k < 3; ++k)
+            sorted[3 * i + k] = indices[3 * size_t(order[i]) + k];
+    }
+    indices.swap(sorted);
+}
+
+bool triangle_mesh::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    watertight_ray w(r);
+    vertex_view vertices(*this);
+    int64_t closest = -1;
+    real b[3];
+    tree.traverse(r, t_min, t_max, [&](uint32_t first, uint32_t count, real& t) {
+        auto i = hit_range(*this, vertices, w, first, count, t_min, t, b);
+        if (i < 0)
+            return false;
+        closest = i;
+        rec.t = t;
+        return true;
+    });
+    if (closest < 0)
+        return false;
+
+    set_triangle_hit(*this, r, static_cast<uint32_t>(closest), b, rec);
+    return true;
+}
+
+bool triangle_mesh::occluded(const ray& r, real t_min, real t_max) const {
+    watertight_ray w(r);
+    vertex_view vertices(*this);
+    return tree.occluded(r, t_min, t_max, [&](uint32_t first, uint32_t count) {
+        real t, b[3];
+        for (auto i = first; i < first + count; ++i) {
+            const auto* v = &indices[3 * size_t(i)];
+            if (hit_triangle(w, vertices[v[0]], vertices[v[1]], vertices[v[2]], t_min, t_max, t, b))
+                return true;
+        }
+        return false;
+    });
+}
+
+void triangle_mesh::hit_packet(const ray* rays, int count, real t_min, real t_max, hit_record* recs, bool* hits) const {
+    real closest_t[max_packet_size];
+    int64_t closest[max_packet_size];
+    vertex_view vertices(*this);
+    real b[max_packet_size][3];
+    for (int k = 0; k < count; ++k) {
+        closest_t[k] = t_max;
+        closest[k] = -1;
+    }
+    tree.traverse_packet(rays, count, t_min, closest_t, [&](uint32_t first, uint32_t n, uint32_t mask, real* t) {
+        for (int k = 0; k < count; ++k) {
+            if (!(mask & (1u << k)))
+                continue;
+            auto i = hit_range(*this, vertices, watertight_ray(rays[k]), first, n, t_min, t[k], b[k]);
+            if (i >= 0)
+                closest[k] = i;
+        }
+    });
+
+    for (int k = 0; k < count; ++k) {
+        hits[k] = closest[k] >= 0;
+        if (!hits[k])
+            continue;
+        recs[k].t = closest_t[k];
+        set_triangle_hit(*this, rays[k], static_cast<uint32_t>(closest[k]), b[k], recs[k]);
+    }
+}
+
+bool triangle_mesh::bounding_box(aabb& output_box) const {
+    output_box = box;
+    return !tree.nodes.empty();
+}
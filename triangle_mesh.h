@@ -0,0 +1,73 @@
+#pragma once
+
+#include "hittable.h"
+#include "bvh.h"
+#include "wide_bvh.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Triangles sharing one set of vertices: positions, and optionally vertex
+// normals for smooth shading, are float buffers indexed three per triangle.
+// The mesh carries its own 8-wide BVH over the triangles, whose leaves are
+// ranges of the index buffer, so the mesh is a single object to the scene.
+// The vertices may instead be used in place from memory the mesh does not
+// own, such as a memory-mapped file; see use_vertices.
+class triangle_mesh : public hittable {
+public:
+    triangle_mesh() {}
+    explicit triangle_mesh(uint32_t m) : mat_id(m) {}
+
+    uint32_t add_vertex(const point3& p);
+    // Reads the count vertices from memory that owner keeps alive instead of
+    // from positions: the three floats of vertex v start v * stride bytes
+    // after position_data, with no alignment required, and its normal's
+    // likewise after normal_data unless that is null. Normals in normals, if
+    // any, still take precedence.
+    void use_vertices(shared_ptr<const void> owner, const char* position_data, const char* normal_data, size_t count, size_t stride);
+    void add_triangle(uint32_t a, uint32_t b, uint32_t c);
+    // Vertex normals averaged from the faces around each vertex, weighted by
+    // their area.
+    void smooth_normals();
+    // Builds the hierarchy and sorts the triangles into its leaf order.
+    void build(bvh_build method = bvh_build::sah);
+
+    size_t vertex_count() const { return vertex_owner ? external_count : positions.size() / 3; }
+    size_t size() const { return indices.size() / 3; }
+    // Where the vertices are read from, and how many bytes apart they are.
+    const char* position_data() const {
+        return vertex_owner ? external_positions : reinterpret_cast<const char*>(positions.data());
+    }
+    size_t position_stride() const { return vertex_owner ? external_stride : 3 * sizeof(float); }
+    const char* normal_data() const {
+        if (!normals.empty())
+            return reinterpret_cast<const char*>(normals.data());
+        return vertex_owner ? external_normals : nullptr;
+    }
+    size_t normal_stride() const { return normals.empty() ? external_stride : 3 * sizeof(float); }
+    point3 vertex(uint32_t v) const {
+        float p[3];
+        memcpy(p, position_data() + position_stride() * v, sizeof(p));
+        return point3(p[0], p[1], p[2]);
+    }
+
+    virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+    virtual bool bounding_box(aabb& output_box) const;
+    virtual bool occluded(const ray& r, real tmin, real tmax) const;
+    virtual void hit_packet(const ray* rays, int count, real tmin, real tmax, hit_record* recs, bool* hits) const;
+
+public:
+    std::vector<float> positions;   // x, y, z per vertex
+    std::vector<float> normals;     // x, y, z per vertex, or empty for flat shading
+    std::vector<uint32_t> indices;  // three vertices per triangle, counter-clockwise seen from the front
+    // The vertices of use_vertices, held in place by vertex_owner.
+    shared_ptr<const void> vertex_owner;
+    const char* external_positions = nullptr;
+    const char* external_normals = nullptr;
+    size_t external_count = 0;
+    size_t external_stride = 3 * sizeof(float);
+    uint32_t mat_id = 0;
+    linear_wide_bvh<8> tree;
+    aabb box;
+};
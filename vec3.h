@@ -4,22 +4,72 @@
 #include <iostream>
 #include "rtweekend.h"
 
+// With RT_SIMD_VEC3 a vec3 fills one SIMD register, four floats (SSE4.1) or
+// four doubles (AVX2), and its arithmetic works on the whole register. The
+// fourth lane is padding; it starts at zero and stays zero under any finite
+// arithmetic, so dot products can sum all four. Without RT_SIMD_VEC3, or on
+// targets missing the instructions, vec3 is three plain reals.
+#if defined(RT_SIMD_VEC3) && (defined(RT_FLOAT) ? (defined(__SSE4_1__) || defined(__AVX__)) : defined(__AVX2__))
+#define RT_VEC3_LANES
+#include <immintrin.h>
+#endif
+
 using std::sqrt;
 
+#if defined(RT_VEC3_LANES)
+namespace vec3_lanes {
+#if defined(RT_FLOAT)
+	using type = __m128;
+	inline type set(real x, real y, real z) { return _mm_set_ps(0, z, y, x); }
+	inline type splat(real t) { return _mm_set1_ps(t); }
+	inline type add(type a, type b) { return _mm_add_ps(a, b); }
+	inline type sub(type a, type b) { return _mm_sub_ps(a, b); }
+	inline type mul(type a, type b) { return _mm_mul_ps(a, b); }
+	inline type neg(type a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+	inline real dot(type a, type b) {
+		auto m = _mm_mul_ps(a, b);
+		auto sums = _mm_add_ps(m, _mm_movehdup_ps(m));
+		return _mm_cvtss_f32(_mm_add_ss(sums, _mm_movehl_ps(sums, sums)));
+	}
+	inline type yzx(type a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+#else
+	using type = __m256d;
+	inline type set(real x, real y, real z) { return _mm256_set_pd(0, z, y, x); }
+	inline type splat(real t) { return _mm256_set1_pd(t); }
+	inline type add(type a, type b) { return _mm256_add_pd(a, b); }
+	inline type sub(type a, type b) { return _mm256_sub_pd(a, b); }
+	inline type mul(type a, type b) { return _mm256_mul_pd(a, b); }
+	inline type neg(type a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+	inline real dot(type a, type b) {
+		auto m = _mm256_mul_pd(a, b);
+		auto sums = _mm_add_pd(_mm256_castpd256_pd128(m), _mm256_extractf128_pd(m, 1));
+		return _mm_cvtsd_f64(_mm_add_sd(sums, _mm_unpackhi_pd(sums, sums)));
+	}
+	inline type yzx(type a) { return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1)); }
+#endif
+}
+#endif
+
 class vec3 {
 public:
+#if defined(RT_VEC3_LANES)
+	vec3() : v(vec3_lanes::set(0, 0, 0)) {}
+	vec3(real e0, real e1, real e2) : v(vec3_lanes::set(e0, e1, e2)) {}
+	explicit vec3(vec3_lanes::type l) : v(l) {}
+#else
 	vec3() : e{ 0, 0, 0 } {}
-	vec3(double e0, double e1, double e2) : e{ e0, e1, e2 } {}
+	vec3(real e0, real e1, real e2) : e{ e0, e1, e2 } {}
+#endif
 
-	double x() const { return e[0]; }
-	double y() const { return e[1]; }
-	double z() const { return e[2]; }
+	real x() const { return e[0]; }
+	real y() const { return e[1]; }
+	real z() const { return e[2]; }
 
 	static vec3 random() {
 		return vec3(random_double(), random_double(), random_double());
 	}
 
-	static vec3 random(double min, double max) {
+	static vec3 random(real min, real max) {
 		return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
 	}
 
@@ -28,10 +78,25 @@ public:
 	static vec3 random_in_hemisphere(const vec3& normal);
 	static vec3 random_in_unit_disk();
 
+#if defined(RT_VEC3_LANES)
+	vec3 operator-() const { return vec3(vec3_lanes::neg(v)); }
+#else
 	vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-	double operator[](int i) const { return e[i]; }
-	double& operator[](int i) { return e[i]; }
+#endif
+	real operator[](int i) const { return e[i]; }
+	real& operator[](int i) { return e[i]; }
 
+#if defined(RT_VEC3_LANES)
+	vec3& operator+=(const vec3& u) {
+		v = vec3_lanes::add(v, u.v);
+		return *this;
+	}
+
+	vec3& operator*=(real t) {
+		v = vec3_lanes::mul(v, vec3_lanes::splat(t));
+		return *this;
+	}
+#else
 	vec3& operator+=(const vec3& v) {
 		e[0] += v.e[0];
 		e[1] += v.e[1];
@@ -39,27 +104,39 @@ public:
 		return *this;
 	}
 
-	vec3& operator*=(double t) {
+	vec3& operator*=(real t) {
 		e[0] *= t;
 		e[1] *= t;
 		e[2] *= t;
 		return *this;
 	}
+#endif
 
-	vec3& operator/=(double t) {
+	vec3& operator/=(real t) {
 		return *this *= 1 / t;
 	}
 
-	double length() const {
+	real length() const {
 		return sqrt(length_squared());
 	}
 
-	double length_squared() const {
+	real length_squared() const {
+#if defined(RT_VEC3_LANES)
+		return vec3_lanes::dot(v, v);
+#else
 		return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+#endif
 	}
 
 public:
-	double e[3];
+#if defined(RT_VEC3_LANES)
+	union {
+		real e[4];
+		vec3_lanes::type v;
+	};
+#else
+	real e[3];
+#endif
 };
 
 // Type aliases
@@ -71,31 +148,51 @@ inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
 	return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
+#if defined(RT_VEC3_LANES)
 inline vec3 operator+(const vec3& u, const vec3& v) {
-	return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+	return vec3(vec3_lanes::add(u.v, v.v));
 }
 
 inline vec3 operator-(const vec3& u, const vec3& v) {
-	return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+	return vec3(vec3_lanes::sub(u.v, v.v));
 }
 
 inline vec3 operator*(const vec3& u, const vec3& v) {
-	return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+	return vec3(vec3_lanes::mul(u.v, v.v));
 }
 
-inline vec3 operator*(double t, const vec3& v) {
-	return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+inline vec3 operator*(real t, const vec3& v) {
+	return vec3(vec3_lanes::mul(vec3_lanes::splat(t), v.v));
 }
 
-inline vec3 operator*(const vec3& v, double t) {
-	return t * v;
+inline real dot(const vec3& u, const vec3& v) {
+	return vec3_lanes::dot(u.v, v.v);
 }
 
-inline vec3 operator/(vec3 v, double t) {
-	return (1 / t) * v;
+// u * v.yzx - u.yzx * v is the cross product with its lanes rotated once,
+// so three shuffles do instead of four.
+inline vec3 cross(const vec3& u, const vec3& v) {
+	using namespace vec3_lanes;
+	return vec3(yzx(sub(mul(u.v, yzx(v.v)), mul(yzx(u.v), v.v))));
+}
+#else
+inline vec3 operator+(const vec3& u, const vec3& v) {
+	return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+}
+
+inline vec3 operator-(const vec3& u, const vec3& v) {
+	return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+}
+
+inline vec3 operator*(const vec3& u, const vec3& v) {
+	return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline double dot(const vec3& u, const vec3& v) {
+inline vec3 operator*(real t, const vec3& v) {
+	return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+}
+
+inline real dot(const vec3& u, const vec3& v) {
 	return u.e[0] * v.e[0]
 		+ u.e[1] * v.e[1]
 		+ u.e[2] * v.e[2];
@@ -106,6 +203,15 @@ inline vec3 cross(const vec3& u, const vec3& v) {
 		u.e[2] * v.e[0] - u.e[0] * v.e[2],
 		u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
+#endif
+
+inline vec3 operator*(const vec3& v, real t) {
+	return t * v;
+}
+
+inline vec3 operator/(vec3 v, real t) {
+	return (1 / t) * v;
+}
 
 inline vec3 unit_vector(vec3 v) {
 	return v / v.length();
@@ -115,9 +221,9 @@ inline vec3 reflect(const vec3& v, const vec3& n) {
 	return v - 2 * dot(v, n) * n;
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
+inline vec3 refract(const vec3& uv, const vec3& n, real etai_over_etat) {
 	auto cos_theta = dot(-uv, n);
 	vec3 r_out_parallel = etai_over_etat * (uv + cos_theta * n);
-	vec3 r_out_perp = -sqrt(1.0 - r_out_parallel.length_squared()) * n;
+	vec3 r_out_perp = -sqrt(1 - r_out_parallel.length_squared()) * n;
 	return r_out_parallel + r_out_perp;
 }
@@ -0,0 +1,57 @@
+// Microbenchmark of the vec3 operations the renderer leans on. Build it once
+// with and once without RT_SIMD_VEC3 and compare the times per call.
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "rtweekend.h"
+#include "vec3.h"
+
+namespace {
+
+const size_t count = 4096;      // vectors per array, small enough to stay in L1/L2
+const int repeats = 20000;
+
+// Runs op over every index repeats times and prints the mean time per call.
+// The results are summed into sink so the compiler cannot drop the work.
+template <typename Op>
+void run(const char* name, Op&& op, real& sink) {
+    auto start = std::chrono::steady_clock::now();
+    real sum = 0;
+    for (int k = 0; k < repeats; ++k) {
+        for (size_t i = 0; i < count; ++i)
+            sum += op(i);
+    }
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    sink += sum;
+    printf("%-12s %6.2f ns\n", name, 1e9 * seconds / (double(repeats) * count));
+}
+
+}
+
+int main()
+{
+    std::vector<vec3> a(count), b(count), n(count);
+    for (size_t i = 0; i < count; ++i) {
+        a[i] = vec3::random(-1, 1);
+        b[i] = vec3::random(-1, 1);
+        n[i] = vec3::random_unit_vector();
+    }
+
+#if defined(RT_VEC3_LANES)
+    printf("vec3: %zu bytes, SIMD lanes\n", sizeof(vec3));
+#else
+    printf("vec3: %zu bytes, scalar\n", sizeof(vec3));
+#endif
+
+    real sink = 0;
+    run("add", [&](size_t i) { return (a[i] + b[i]).x(); }, sink);
+    run("dot", [&](size_t i) { return dot(a[i], b[i]); }, sink);
+    run("cross", [&](size_t i) { return cross(a[i], b[i]).y(); }, sink);
+    run("unit_vector", [&](size_t i) { return unit_vector(a[i]).z(); }, sink);
+    run("reflect", [&](size_t i) { return reflect(a[i], n[i]).x(); }, sink);
+    run("refract", [&](size_t i) { return refract(unit_vector(a[i]), n[i], real(0.7)).y(); }, sink);
+    printf("(checksum %g)\n", double(sink));
+    return 0;
+}
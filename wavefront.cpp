@@ -0,0 +1,123 @@
+#include "wavefront.h"
+
+#include <vector>
+
+namespace {
+
+// Paths in flight at once: enough to make long queues per material kind,
+// few enough that their state stays in the L2 cache.
+const size_t wavefront_width = 4096;
+
+// Sort keys of the shading stage: misses first, then one per material kind.
+const int shade_keys = 1 + int(material::kind::count);
+static_assert(shade_keys < 256, "shade keys must fit sort_by_key's buckets");
+
+struct wavefront_path {
+    path_state state;
+    pcg32 rng;          // the random stream of the path, carried between stages
+    uint32_t request;   // index of the sample it computes
+};
+
+// The octant a direction points into, 0 to 7.
+uint8_t octant(const vec3& d) {
+    return uint8_t((d.x() < 0) | (d.y() < 0) << 1 | (d.z() < 0) << 2);
+}
+
+// Fills order with the indices 0 to count - 1 stably sorted by keys, which
+// are all below buckets.
+void sort_by_key(const uint8_t* keys, size_t count, int buckets, std::vector<uint32_t>& order) {
+    uint32_t start[256] = {};
+    for (size_t k = 0; k < count; ++k)
+        ++start[keys[k] + 1];
+    for (int b = 1; b < buckets; ++b)
+        start[b] += start[b - 1];
+    order.resize(count);
+    for (size_t k = 0; k < count; ++k)
+        order[start[keys[k]]++] = uint32_t(k);
+}
+
+}
+
+void trace_wavefront(const sample_request* requests, size_t count, const hittable& world, const material_table& materials, const light_list& lights,
+    const camera& cam, const render_settings& settings, color* results, path_counts& counts)
+{
+    std::vector<wavefront_path> paths;
+    paths.reserve(wavefront_width);
+    std::vector<hit_record> recs(wavefront_width);
+    std::vector<uint8_t> hits(wavefront_width), alive(wavefront_width), keys(wavefront_width);
+    std::vector<uint32_t> order;
+    std::vector<shadow_query> shadows;
+    std::vector<uint32_t> shadow_paths;
+    std::vector<uint8_t> shadow_keys;
+    std::vector<uint32_t> shadow_order;
+
+    size_t next = 0;
+    while (true) {
+        // Generate: camera rays for the free slots.
+        for (; paths.size() < wavefront_width && next < count; ++next) {
+            const auto& q = requests[next];
+            auto r = camera_ray(cam, settings, q.i, q.j, q.sample);
+            if (settings.max_depth <= 0)
+                results[next] = color(0, 0, 0);
+            else
+                paths.push_back(wavefront_path{ start_path(r), thread_rng(), uint32_t(next) });
+        }
+        if (paths.empty())
+            break;
+        auto n = paths.size();
+
+        // Intersect, in direction octant order, so rays that follow each
+        // other tend to visit the same nodes.
+        for (size_t k = 0; k < n; ++k)
+            keys[k] = octant(paths[k].state.path.direction());
+        sort_by_key(keys.data(), n, 8, order);
+        for (auto k : order)
+            hits[k] = world.hit(paths[k].state.path, epsilon, infinity, recs[k]);
+        counts.rays += n;
+
+        // Shade, one material kind after the other.
+        for (size_t k = 0; k < n; ++k)
+            keys[k] = hits[k] ? uint8_t(1 + int(materials[recs[k].mat_id].type)) : 0;
+        sort_by_key(keys.data(), n, shade_keys, order);
+        shadows.clear();
+        shadow_paths.clear();
+        shadow_keys.clear();
+        for (auto k : order) {
+            auto& w = paths[k];
+            if (!hits[k]) {
+                miss(w.state, settings);
+                alive[k] = false;
+                continue;
+            }
+            thread_rng() = w.rng;
+            shadow_query shadow;
+            bool has_shadow;
+            alive[k] = shade(w.state, recs[k], materials, lights, settings, shadow, has_shadow, counts);
+            w.rng = thread_rng();
+            if (has_shadow) {
+                shadows.push_back(shadow);
+                shadow_paths.push_back(k);
+                shadow_keys.push_back(octant(shadow.r.direction()));
+            }
+        }
+
+        // Shadow rays, also by octant. A path has at most one of them per
+        // bounce, so the order they are added in does not matter.
+        sort_by_key(shadow_keys.data(), shadows.size(), 8, shadow_order);
+        for (auto s : shadow_order) {
+            const auto& shadow = shadows[s];
+            if (!world.occluded(shadow.r, epsilon, shadow.t_max))
+                paths[shadow_paths[s]].state.radiance += shadow.contribution;
+        }
+
+        // Compact: finished paths hand in their radiance and make room.
+        size_t kept = 0;
+        for (size_t k = 0; k < n; ++k) {
+            if (alive[k])
+                paths[kept++] = paths[k];
+            else
+                results[paths[k].request] = paths[k].state.radiance;
+        }
+        paths.resize(kept);
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "render.h"
+
+#include <cstddef>
+
+// One camera sample to take: the given sample of pixel (i, j).
+struct sample_request {
+    int i, j;
+    int sample;
+};
+
+// Computes the radiance of each of the count samples in requests into
+// results, like ray_color but breadth first. A batch of paths goes through
+// one stage at a time: camera rays are generated, intersected in direction
+// octant order, shaded grouped by material kind, and their shadow rays
+// traced; finished paths are then compacted out and replaced by new ones.
+// Every path keeps its own random stream, so the results match ray_color.
+void trace_wavefront(const sample_request* requests, size_t count, const hittable& world, const material_table& materials, const light_list& lights,
+    const camera& cam, const render_settings& settings, color* results, path_counts& counts);
@@ -0,0 +1,495 @@
+#pragma once
+
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit of x, which must not be 0.
+inline int ctz(uint32_t x) {
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return static_cast<int>(i);
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+// N-wide BVH node with the children's bounds stored as structure of arrays,
+// so one SIMD slab test covers all of them.
+template <int N>
+struct alignas(32) wide_bvh_node {
+    float min_x[N], min_y[N], min_z[N];
+    float max_x[N], max_y[N], max_z[N];
+    uint32_t child[N];  // leaf: first primitive, interior: child node
+    uint16_t count[N];  // number of primitives, 0 for interior children
+};
+
+// Ray in the single precision form the node test wants. Picking the near and
+// far planes by direction sign keeps empty slots (min > max) missing.
+// Rounding must not let the ray slip past a box it only touches, as
+// triangles touch their bounds at the corners: the far distances use a
+// reciprocal grown by a few ulps to cover the rounding of the slab
+// arithmetic (Ize 2013), and slack, added to the far end, covers rounding
+// the origin to float. Entry distances may come out too late by as much,
+// which only matters for culling against a hit already found.
+struct wide_ray {
+    float orig[3];
+    float inv_dir[3];
+    float far_inv_dir[3];
+    float slack;
+    bool dir_is_neg[3];
+
+    wide_ray() {}
+    explicit wide_ray(const ray& r) {
+        slack = 0;
+        for (int a = 0; a < 3; ++a) {
+            orig[a] = static_cast<float>(r.orig[a]);
+            inv_dir[a] = static_cast<float>(1 / r.dir[a]);
+            far_inv_dir[a] = inv_dir[a] * (1 + 4 * std::numeric_limits<float>::epsilon());
+            dir_is_neg[a] = inv_dir[a] < 0;
+            // Moving the origin by d shifts both ends of a slab by d / dir.
+            // An axis the ray runs along has no finite slab to widen.
+            auto shift = static_cast<float>(std::fabs((orig[a] - r.orig[a]) * inv_dir[a]));
+            if (std::isfinite(shift))
+                slack = std::max(slack, 2 * shift * (1 + 4 * std::numeric_limits<float>::epsilon()));
+        }
+    }
+};
+
+// Tests r against every child of node; returns a bit mask of the children hit
+// within [t_min, t_max] and their entry distances in t_near.
+template <int N>
+inline int intersect_children(const wide_bvh_node<N>& node, const wide_ray& r, float t_min, float t_max, float* t_near) {
+    const float* lo[3] = { node.min_x, node.min_y, node.min_z };
+    const float* hi[3] = { node.max_x, node.max_y, node.max_z };
+    int mask = 0;
+    for (int i = 0; i < N; ++i) {
+        auto t0 = t_min;
+        auto t1 = t_max;
+        for (int a = 0; a < 3; ++a) {
+            auto near_t = ((r.dir_is_neg[a] ? hi[a] : lo[a])[i] - r.orig[a]) * r.inv_dir[a];
+            auto far_t = ((r.dir_is_neg[a] ? lo[a] : hi[a])[i] - r.orig[a]) * r.far_inv_dir[a];
+            t0 = near_t > t0 ? near_t : t0;
+            t1 = far_t < t1 ? far_t : t1;
+        }
+        t1 += r.slack;
+        t_near[i] = t0;
+        if (t0 <= t1) mask |= 1 << i;
+    }
+    return mask;
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(__AVX__)
+template <>
+inline int intersect_children<4>(const wide_bvh_node<4>& node, const wide_ray& r, float t_min, float t_max, float* t_near) {
+    auto t0 = _mm_set1_ps(t_min);
+    auto t1 = _mm_set1_ps(t_max);
+    const float* lo[3] = { node.min_x, node.min_y, node.min_z };
+    const float* hi[3] = { node.max_x, node.max_y, node.max_z };
+    for (int a = 0; a < 3; ++a) {
+        auto o = _mm_set1_ps(r.orig[a]);
+        auto near_t = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(r.dir_is_neg[a] ? hi[a] : lo[a]), o), _mm_set1_ps(r.inv_dir[a]));
+        auto far_t = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(r.dir_is_neg[a] ? lo[a] : hi[a]), o), _mm_set1_ps(r.far_inv_dir[a]));
+        // A NaN slab (origin on the plane of an axis the ray runs along) leaves the interval alone.
+        t0 = _mm_max_ps(near_t, t0);
+        t1 = _mm_min_ps(far_t, t1);
+    }
+    t1 = _mm_add_ps(t1, _mm_set1_ps(r.slack));
+    _mm_storeu_ps(t_near, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+#endif
+
+#if defined(__AVX__)
+template <>
+inline int intersect_children<8>(const wide_bvh_node<8>& node, const wide_ray& r, float t_min, float t_max, float* t_near) {
+    auto t0 = _mm256_set1_ps(t_min);
+    auto t1 = _mm256_set1_ps(t_max);
+    const float* lo[3] = { node.min_x, node.min_y, node.min_z };
+    const float* hi[3] = { node.max_x, node.max_y, node.max_z };
+    for (int a = 0; a < 3; ++a) {
+        auto o = _mm256_set1_ps(r.orig[a]);
+        auto near_t = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(r.dir_is_neg[a] ? hi[a] : lo[a]), o), _mm256_set1_ps(r.inv_dir[a]));
+        auto far_t = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(r.dir_is_neg[a] ? lo[a] : hi[a]), o), _mm256_set1_ps(r.far_inv_dir[a]));
+        t0 = _mm256_max_ps(near_t, t0);
+        t1 = _mm256_min_ps(far_t, t1);
+    }
+    t1 = _mm256_add_ps(t1, _mm256_set1_ps(r.slack));
+    _mm256_storeu_ps(t_near, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif
+
+// N-wide hierarchy collapsed from a binary linear_bvh: every wide node adopts
+// the largest descendants of a binary node until it has N children. Leaves
+// keep the primitive ranges of the binary tree, so its build order still holds.
+template <int N>
+class linear_wide_bvh {
+public:
+    static const int stack_size = 64 * N;
+
+    linear_wide_bvh() {}
+    linear_wide_bvh(const linear_bvh& binary);
+
+    // Same contract as linear_bvh::traverse.
+    template <typename LeafHit>
+    bool traverse(const ray& r, real t_min, real t_max, LeafHit&& leaf_hit) const;
+    // Same contract as linear_bvh::occluded.
+    template <typename LeafOccluded>
+    bool occluded(const ray& r, real t_min, real t_max, LeafOccluded&& leaf_occluded) const;
+    // traverse for up to max_packet_size rays at once: the rays share one
+    // stack and every node is fetched once for all of them that enter it.
+    // leaf_hit(first, count, mask, t_max) tests the rays whose bits are set
+    // in mask against the leaf and shrinks their entries of t_max.
+    template <typename LeafHit>
+    void traverse_packet(const ray* rays, int count, real t_min, real* t_max, LeafHit&& leaf_hit) const;
+
+private:
+    void collapse(const linear_bvh& binary, uint32_t binary_index, size_t wide_index);
+
+public:
+    std::vector<wide_bvh_node<N>> nodes;
+};
+
+template <int N>
+class wide_bvh : public hittable {
+public:
+    wide_bvh() {}
+    wide_bvh(const hittable_list& list, bvh_build method = bvh_build::sah);
+
+    virtual bool hit(const ray& r, real tmin, real tmax, hit_record& rec) const;
+    virtual bool bounding_box(aabb& output_box) const;
+    virtual bool occluded(const ray& r, real tmin, real tmax) const;
+    virtual void hit_packet(const ray* rays, int count, real tmin, real tmax, hit_record* recs, bool* hits) const;
+
+public:
+    linear_wide_bvh<N> tree;
+    std::vector<shared_ptr<hittable>> objects; // in leaf order
+    aabb box;
+};
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+template <int N>
+linear_wide_bvh<N>::linear_wide_bvh(const linear_bvh& binary) {
+    if (binary.nodes.empty())
+        return;
+
+    nodes.emplace_back();
+    collapse(binary, 0, 0);
+}
+
+template <int N>
+void linear_wide_bvh<N>::collapse(const linear_bvh& binary, uint32_t binary_index, size_t wide_index) {
+    auto area = [&](uint32_t i) {
+        const auto& b = binary.nodes[i];
+        auto dx = b.bounds_max[0] - b.bounds_min[0];
+        auto dy = b.bounds_max[1] - b.bounds_min[1];
+        auto dz = b.bounds_max[2] - b.bounds_min[2];
+        return dx * dy + dy * dz + dz * dx;
+    };
+
+    // Open up the interior child with the largest surface until N are gathered.
+    uint32_t slots[N];
+    int used = 0;
+    const auto& root = binary.nodes[binary_index];
+    if (root.count > 0) {
+        slots[used++] = binary_index;
+    } else {
+        slots[used++] = binary_index + 1;
+        slots[used++] = root.offset;
+    }
+    while (used < N) {
+        int widest = -1;
+        for (int i = 0; i < used; ++i) {
+            if (binary.nodes[slots[i]].count == 0 && (widest < 0 || area(slots[i]) > area(slots[widest])))
+                widest = i;
+        }
+        if (widest < 0)
+            break;
+        auto opened = slots[widest];
+        slots[widest] = opened + 1;
+        slots[used++] = binary.nodes[opened].offset;
+    }
+
+    for (int i = 0; i < N; ++i) {
+        auto& node = nodes[wide_index];
+        if (i >= used) {
+            node.min_x[i] = node.min_y[i] = node.min_z[i] = std::numeric_limits<float>::infinity();
+            node.max_x[i] = node.max_y[i] = node.max_z[i] = -std::numeric_limits<float>::infinity();
+            node.child[i] = 0;
+            node.count[i] = 0;
+            continue;
+        }
+
+        const auto& b = binary.nodes[slots[i]];
+        node.min_x[i] = b.bounds_min[0];
+        node.min_y[i] = b.bounds_min[1];
+        node.min_z[i] = b.bounds_min[2];
+        node.max_x[i] = b.bounds_max[0];
+        node.max_y[i] = b.bounds_max[1];
+        node.max_z[i] = b.bounds_max[2];
+        node.count[i] = b.count;
+        if (b.count > 0) {
+            node.child[i] = b.offset;
+        } else {
+            auto child_index = nodes.size();
+            nodes[wide_index].child[i] = static_cast<uint32_t>(child_index);
+            nodes.emplace_back();
+            collapse(binary, slots[i], child_index);
+        }
+    }
+}
+
+template <int N>
+template <typename LeafHit>
+bool linear_wide_bvh<N>::traverse(const ray& r, real t_min, real t_max, LeafHit&& leaf_hit) const {
+    if (nodes.empty())
+        return false;
+
+    wide_ray wr(r);
+
+    struct entry {
+        uint32_t child;
+        uint16_t count;
+        float t_near;
+    };
+    entry stack[stack_size];
+    int stack_top = 0;
+    stack[stack_top++] = { 0, 0, static_cast<float>(t_min) };
+
+    bool hit_anything = false;
+    // Float slabs are only conservative up to rounding, so widen the far end a little.
+    const float t_scale = 1 + 4 * std::numeric_limits<float>::epsilon();
+
+    while (stack_top > 0) {
+        auto e = stack[--stack_top];
+        if (e.t_near > t_max)
+            continue;
+
+        if (e.count > 0) {
+            if (leaf_hit(e.child, e.count, t_max))
+                hit_anything = true;
+            continue;
+        }
+
+        const auto& node = nodes[e.child];
+        alignas(32) float t_near[N];
+        auto mask = intersect_children<N>(node, wr, static_cast<float>(t_min), static_cast<float>(t_max) * t_scale, t_near);
+
+        // Push the children far to near so the nearest one is popped first.
+        int base = stack_top;
+        for (int i = 0; i < N; ++i) {
+            if (!(mask & (1 << i)))
+                continue;
+            entry child = { node.child[i], node.count[i], t_near[i] };
+            int j = stack_top++;
+            while (j > base && stack[j - 1].t_near < child.t_near) {
+                stack[j] = stack[j - 1];
+                --j;
+            }
+            stack[j] = child;
+        }
+    }
+
+    return hit_anything;
+}
+
+template <int N>
+template <typename LeafOccluded>
+bool linear_wide_bvh<N>::occluded(const ray& r, real t_min, real t_max, LeafOccluded&& leaf_occluded) const {
+    if (nodes.empty())
+        return false;
+
+    wide_ray wr(r);
+
+    // Any hit ends the search and t_max never shrinks, so children need no
+    // sorting and their entry distances are not kept.
+    struct entry {
+        uint32_t child;
+        uint16_t count;
+    };
+    entry stack[stack_size];
+    int stack_top = 0;
+    stack[stack_top++] = { 0, 0 };
+
+    const float t_scale = 1 + 4 * std::numeric_limits<float>::epsilon();
+    auto t_near_max = static_cast<float>(t_max) * t_scale;
+
+    while (stack_top > 0) {
+        auto e = stack[--stack_top];
+        if (e.count > 0) {
+            if (leaf_occluded(e.child, e.count))
+                return true;
+            continue;
+        }
+
+        const auto& node = nodes[e.child];
+        alignas(32) float t_near[N];
+        auto mask = intersect_children<N>(node, wr, static_cast<float>(t_min), t_near_max, t_near);
+        for (int i = 0; i < N; ++i) {
+            if (mask & (1 << i))
+                stack[stack_top++] = { node.child[i], node.count[i] };
+        }
+    }
+
+    return false;
+}
+
+template <int N>
+template <typename LeafHit>
+void linear_wide_bvh<N>::traverse_packet(const ray* rays, int count, real t_min, real* t_max, LeafHit&& leaf_hit) const {
+    if (nodes.empty() || count == 0)
+        return;
+
+    wide_ray packet[max_packet_size];
+    for (int k = 0; k < count; ++k)
+        packet[k] = wide_ray(rays[k]);
+
+    // Same widening of the far end as in traverse.
+    const float t_scale = 1 + 4 * std::numeric_limits<float>::epsilon();
+    float t_far[max_packet_size];
+    for (int k = 0; k < count; ++k)
+        t_far[k] = static_cast<float>(t_max[k]) * t_scale;
+
+    struct entry {
+        uint32_t child;
+        uint16_t count;
+        uint32_t mask;  // rays that entered it
+        float t_near;   // nearest entry among them
+    };
+    entry stack[stack_size];
+    int stack_top = 0;
+    stack[stack_top++] = { 0, 0, (1u << count) - 1, static_cast<float>(t_min) };
+
+    while (stack_top > 0) {
+        auto e = stack[--stack_top];
+
+        if (e.count > 0) {
+            // Rays whose closest hit so far lies before the leaf skip it.
+            uint32_t mask = 0;
+            for (int k = 0; k < count; ++k) {
+                if ((e.mask & (1u << k)) && e.t_near <= t_far[k])
+                    mask |= 1u << k;
+            }
+            if (!mask)
+                continue;
+            leaf_hit(e.child, e.count, mask, t_max);
+            for (int k = 0; k < count; ++k) {
+                if (mask & (1u << k))
+                    t_far[k] = static_cast<float>(t_max[k]) * t_scale;
+            }
+            continue;
+        }
+
+        // Each ray in the packet tests all children at once, as in traverse;
+        // the children then carry the set of rays that entered them.
+        const auto& node = nodes[e.child];
+        uint32_t masks[N] = {};
+        float nearest[N];
+        for (int i = 0; i < N; ++i)
+            nearest[i] = std::numeric_limits<float>::infinity();
+        for (int k = 0; k < count; ++k) {
+            if (!(e.mask & (1u << k)))
+                continue;
+            alignas(32) float t_near[N];
+            auto hit = intersect_children<N>(node, packet[k], static_cast<float>(t_min), t_far[k], t_near);
+            for (; hit; hit &= hit - 1) {
+                int i = ctz(hit);
+                masks[i] |= 1u << k;
+                nearest[i] = t_near[i] < nearest[i] ? t_near[i] : nearest[i];
+            }
+        }
+
+        // Children sorted far to near by their nearest entry, as in traverse.
+        int base = stack_top;
+        for (int i = 0; i < N; ++i) {
+            auto mask = masks[i];
+            auto t_near = nearest[i];
+            if (!mask)
+                continue;
+            entry child = { node.child[i], node.count[i], mask, t_near };
+            int j = stack_top++;
+            while (j > base && stack[j - 1].t_near < child.t_near) {
+                stack[j] = stack[j - 1];
+                --j;
+            }
+            stack[j] = child;
+        }
+    }
+}
+
+template <int N>
+wide_bvh<N>::wide_bvh(const hittable_list& list, bvh_build method) {
+    bvh binary(list, method);
+    tree = linear_wide_bvh<N>(binary.tree);
+    objects = std::move(binary.objects);
+    box = binary.tree.bounds();
+}
+
+template <int N>
+bool wide_bvh<N>::hit(const ray& r, real t_min, real t_max, hit_record& rec) const {
+    return tree.traverse(r, t_min, t_max, [&](uint32_t first, uint32_t count, real& closest) {
+        bool hit_anything = false;
+        for (auto i = first; i < first + count; ++i) {
+            if (objects[i]->hit(r, t_min, closest, rec)) {
+                hit_anything = true;
+                closest = rec.t;
+            }
+        }
+        return hit_anything;
+    });
+}
+
+template <int N>
+bool wide_bvh<N>::occluded(const ray& r, real t_min, real t_max) const {
+    return tree.occluded(r, t_min, t_max, [&](uint32_t first, uint32_t count) {
+        for (auto i = first; i < first + count; ++i) {
+            if (objects[i]->occluded(r, t_min, t_max))
+                return true;
+        }
+        return false;
+    });
+}
+
+template <int N>
+void wide_bvh<N>::hit_packet(const ray* rays, int count, real t_min, real t_max, hit_record* recs, bool* hits) const {
+    real closest[max_packet_size];
+    for (int k = 0; k < count; ++k) {
+        closest[k] = t_max;
+        hits[k] = false;
+    }
+    tree.traverse_packet(rays, count, t_min, closest, [&](uint32_t first, uint32_t n, uint32_t mask, real* t) {
+        for (int k = 0; k < count; ++k) {
+            if (!(mask & (1u << k)))
+                continue;
+            for (auto i = first; i < first + n; ++i) {
+                if (objects[i]->hit(rays[k], t_min, t[k], recs[k])) {
+                    hits[k] = true;
+                    t[k] = recs[k].t;
+                }
+            }
+        }
+    });
+}
+
+template <int N>
+bool wide_bvh<N>::bounding_box(aabb& output_box) const {
+    output_box = box;
+    return !tree.nodes.empty();
+}